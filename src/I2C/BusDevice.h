@@ -0,0 +1,23 @@
+#ifndef BUS_DEVICE_H_
+#define BUS_DEVICE_H_
+
+namespace EE513{
+
+/**
+ * @class BusDevice
+ * @brief Register level interface to a device on a bus. It is implemented by I2CDevice for real
+ * hardware and by register file models for running the drivers on a machine without the device.
+ */
+class BusDevice{
+public:
+	virtual unsigned char readRegister(unsigned int registerAddress) = 0;
+	virtual int readRegisters(unsigned int fromAddress, unsigned char* buffer, unsigned int number) = 0;
+	virtual int writeRegister(unsigned int registerAddress, unsigned char value) = 0;
+	virtual int writeRegisters(unsigned int fromAddress, const unsigned char* values, unsigned int number) = 0;
+	virtual void close() = 0;
+	virtual ~BusDevice(){}
+};
+
+} /* namespace EE513*/
+
+#endif /* BUS_DEVICE_H_ */
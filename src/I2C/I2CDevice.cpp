@@ -23,13 +23,15 @@ namespace EE513 {
  */
 I2CDevice::I2CDevice(unsigned int bus, unsigned int device) {
 	this->file=-1;
+	this->combined=false;
 	this->bus = bus;
 	this->device = device;
 	this->open();
 }
 
 /**
- * Open a connection to an I2C device
+ * Open a connection to an I2C device. The adapter functionality is queried so that
+ * register reads can use a single I2C_RDWR transaction where it is supported.
  * @return 1 on failure to open to the bus or device, 0 on success.
  */
 int I2CDevice::open(){
@@ -45,9 +47,41 @@ int I2CDevice::open(){
       perror("I2C: Failed to connect to the device\n");
 	  return 1;
    }
+   unsigned long funcs = 0;
+   this->combined = (ioctl(this->file, I2C_FUNCS, &funcs) == 0) && (funcs & I2C_FUNC_I2C);
    return 0;
 }
 
+/**
+ * Write the register pointer and read back a block of registers as one combined
+ * transaction (repeated start, no STOP in between) using the I2C_RDWR ioctl. No other
+ * bus master can move the register pointer between the write and the read.
+ * Falls back to a separate write() and read() if the adapter is not I2C_FUNC_I2C capable.
+ * @param registerAddress the address to start reading from
+ * @param data the buffer that receives the register values
+ * @param number the number of registers to read
+ * @return 1 on failure, 0 on success.
+ */
+int I2CDevice::combinedRead(unsigned char registerAddress, unsigned char* data, unsigned int number){
+   if(!this->combined){
+      if(this->write(registerAddress)) return 1;
+      return (::read(this->file, data, number)!=(int)number) ? 1 : 0;
+   }
+   struct i2c_msg messages[2];
+   messages[0].addr  = this->device;
+   messages[0].flags = 0;
+   messages[0].len   = 1;
+   messages[0].buf   = &registerAddress;
+   messages[1].addr  = this->device;
+   messages[1].flags = I2C_M_RD;
+   messages[1].len   = number;
+   messages[1].buf   = data;
+   struct i2c_rdwr_ioctl_data transaction;
+   transaction.msgs  = messages;
+   transaction.nmsgs = 2;
+   return (ioctl(this->file, I2C_RDWR, &transaction) < 0) ? 1 : 0;
+}
+
 /**
  * Write a single byte value to a single register.
  * @param registerAddress The register address
@@ -66,6 +100,30 @@ int I2CDevice::writeRegister(unsigned int registerAddress, unsigned char value){
    return 0;
 }
 
+/**
+ * Write a block of consecutive registers in a single transaction. The register pointer
+ * auto-increments on the device after every byte, so the block is sent as the start
+ * address followed by the values.
+ * @param fromAddress The address of the first register to write
+ * @param values The values to be written, values[0] goes to fromAddress
+ * @param number The number of registers to write, at most 256
+ * @return 1 on failure to write, 0 on success.
+ */
+int I2CDevice::writeRegisters(unsigned int fromAddress, const unsigned char* values, unsigned int number){
+   unsigned char buffer[257];
+   if(number > sizeof(buffer)-1){
+      cerr << "I2C: Burst write of " << number << " registers is too long" << endl;
+      return 1;
+   }
+   buffer[0] = fromAddress;
+   for(unsigned int i=0; i<number; i++) buffer[i+1] = values[i];
+   if(::write(this->file, buffer, number+1)!=(int)(number+1)){
+      perror("I2C: Failed burst write to the device\n");
+      return 1;
+   }
+   return 0;
+}
+
 /**
  * Write a single value to the I2C device. Used to set up the device to read from a
  * particular address.
@@ -88,9 +146,8 @@ int I2CDevice::write(unsigned char value){
  * @return the byte value at the register address.
  */
 unsigned char I2CDevice::readRegister(unsigned int registerAddress){
-   this->write(registerAddress);
    unsigned char buffer[1];
-   if(::read(this->file, buffer, 1)!=1){
+   if(this->combinedRead(registerAddress, buffer, 1)){
       perror("I2C: Failed to read in the value.\n");
       return 1;
    }
@@ -106,15 +163,32 @@ unsigned char I2CDevice::readRegister(unsigned int registerAddress){
  * @return a pointer of type unsigned char* that points to the first element in the block of registers
  */
 unsigned char* I2CDevice::readRegisters(unsigned int number, unsigned int fromAddress){
-	this->write(fromAddress);
 	unsigned char* data = new unsigned char[number];
-    if(::read(this->file, data, number)!=(int)number){
+    if(this->combinedRead(fromAddress, data, number)){
        perror("IC2: Failed to read in the full buffer.\n");
+	   delete [] data;
 	   return NULL;
     }
 	return data;
 }
 
+/**
+ * Method to read a number of registers into a buffer owned by the caller. Unlike the
+ * pointer returning version above it performs no heap allocation, so it is the one to
+ * use in polling loops.
+ * @param fromAddress the starting address to read from
+ * @param buffer the caller provided buffer, at least number bytes long
+ * @param number the number of registers to read from the device
+ * @return 1 on failure to read, 0 on success.
+ */
+int I2CDevice::readRegisters(unsigned int fromAddress, unsigned char* buffer, unsigned int number){
+    if(this->combinedRead(fromAddress, buffer, number)){
+       perror("IC2: Failed to read in the full buffer.\n");
+	   return 1;
+    }
+	return 0;
+}
+
 /**
  * Method to dump the registers to the standard output. It inserts a return 
  * character after every 16 values and displays the results in hexadecimal to give 
@@ -126,9 +200,11 @@ unsigned char* I2CDevice::readRegisters(unsigned int number, unsigned int fromAd
 
 void I2CDevice::debugDumpRegisters(unsigned int number){
 	cout << "Dumping Registers for Debug Purposes:" << endl;
-	unsigned char *registers = this->readRegisters(number);
+	unsigned char registers[256];
+	if(number > sizeof(registers)) number = sizeof(registers);
+	if(this->readRegisters(0, registers, number)) return;
 	for(int i=0; i<(int)number; i++){
-		cout << HEX(*(registers+i)) << " ";
+		cout << HEX(registers[i]) << " ";
 		if (i%16==15) cout << endl;
 	}
 	cout << dec;
@@ -1,6 +1,8 @@
 #ifndef I2C_H_
 #define I2C_H_
 
+#include "BusDevice.h"
+
 #define I2C_0 "/dev/i2c-0"
 #define I2C_1 "/dev/i2c-1"
 
@@ -10,18 +12,22 @@ namespace EE513{
  * @class I2CDevice
  * @brief Generic I2C Device class that can be used to connect to any type of I2C device and read or write to its registers
  */
-class I2CDevice{
+class I2CDevice: public BusDevice{
 private:
 	unsigned int bus;
 	unsigned int device;
     int file;
+	bool combined;
+	int combinedRead(unsigned char registerAddress, unsigned char* data, unsigned int number);
 public:
 	I2CDevice(unsigned int bus, unsigned int device);
 	virtual int open();
 	virtual int write(unsigned char value);
 	virtual unsigned char readRegister(unsigned int registerAddress);
 	virtual unsigned char* readRegisters(unsigned int number, unsigned int fromAddress=0);
+	virtual int readRegisters(unsigned int fromAddress, unsigned char* buffer, unsigned int number);
 	virtual int writeRegister(unsigned int registerAddress, unsigned char value);
+	virtual int writeRegisters(unsigned int fromAddress, const unsigned char* values, unsigned int number);
 	virtual void debugDumpRegisters(unsigned int number = 0xff);
 	virtual void close();
 	virtual ~I2CDevice();
@@ -0,0 +1,133 @@
+#ifndef BCD_H_
+#define BCD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * BCD conversion for the DS3231 registers.
+ *
+ * bcd_to_decimal() and decimal_to_bcd() are single lookups in 256 entry tables that are built at
+ * compile time. bcd_decode_time() and bcd_decode_alarms() decode a whole 7 byte register block in
+ * one 64-bit value: every byte is masked down to its BCD digits (the 12/24 hour bit decides the hours
+ * mask) and then tens * 10 + ones is computed for all eight lanes at once. The largest lane result
+ * is 0xF * 10 + 0xF = 165, so no lane carries into the next. The lanes are defined by significance,
+ * which makes the result the same on little and big endian machines.
+ *
+ * A register whose masked digits are not BCD (a nibble above 9, e.g. from a corrupt read) decodes
+ * to 0xFF on every path: the tables hold 0xFF for it, and the lane decoder sets such a lane to 0xFF.
+ */
+
+typedef struct bcd_tables_t {
+    uint8_t to_decimal[256];    // indexed by the BCD byte, 0xFF if a nibble is not a digit
+    uint8_t to_bcd[256];        // indexed by the decimal value, 0xFF above 99
+} bcd_tables_t;
+
+constexpr bcd_tables_t bcd_make_tables()
+{
+    bcd_tables_t t = {};
+    for(int i = 0; i < 256; i++)
+    {
+        t.to_decimal[i] = ((i & 0x0F) > 9 || (i >> 4) > 9) ? 0xFF : (i & 0x0F) + 10 * (i >> 4);
+        t.to_bcd[i]     = (i > 99) ? 0xFF : ((i / 10) << 4) | (i % 10);
+    }
+    return t;
+}
+
+inline constexpr bcd_tables_t bcd_tables = bcd_make_tables();
+
+constexpr uint8_t bcd_to_decimal(uint8_t bcd)     { return bcd_tables.to_decimal[bcd]; }
+constexpr uint8_t decimal_to_bcd(uint8_t decimal) { return bcd_tables.to_bcd[decimal]; }
+
+// Lane masks that keep the BCD digits of each register, the hours lanes are set per read
+#define BCD_TIME_MASK       0x00FF1F3F07007F7FULL   // 0x00-0x06: s, m, h, day, date, month (no century), year
+#define BCD_ALARM_MASK      0x003F007F3F007F7FULL   // 0x07-0x0D: s, m, h, day/date, m, h, day/date (no AxMx, DY/DT)
+
+/**
+ * Returns the digit mask of an hours register: 0x1F in 12 hour mode (bit 6 set), 0x3F otherwise.
+ */
+constexpr uint64_t bcd_hours_mask(uint8_t hours_reg)
+{
+    return 0x3F ^ ((hours_reg >> 1) & 0x20);
+}
+
+/**
+ * Converts every lane of an already masked register block from BCD to decimal, a lane with a
+ * nibble above 9 becomes 0xFF like in the tables. Adding 6 to a nibble carries into bit 4 of the
+ * lane exactly when the nibble is above 9.
+ */
+constexpr uint64_t bcd_decode_lanes(uint64_t x)
+{
+    uint64_t ones = x & 0x0F0F0F0F0F0F0F0FULL;
+    uint64_t tens = (x >> 4) & 0x0F0F0F0F0F0F0F0FULL;
+    uint64_t invalid = (((ones + 0x0606060606060606ULL) | (tens + 0x0606060606060606ULL)) >> 4) & 0x0101010101010101ULL;
+    return (ones + (tens << 3) + (tens << 1)) | (invalid * 0xFF);
+}
+
+/**
+ * Loads 7 registers into the low significance lanes of a 64-bit value, lane i holds regs[i]. The
+ * bytes are read one by one, an 8 byte load would read past the block.
+ */
+inline uint64_t bcd_load7(const uint8_t* regs)
+{
+    uint64_t x = 0;
+    for(int i = 0; i < 7; i++) x |= static_cast<uint64_t>(regs[i]) << (8 * i);
+    return x;
+}
+
+/**
+ * Decodes the time registers 0x00 through 0x06 into decimal: out[0] seconds, out[1] minutes,
+ * out[2] hours (1-12 or 0-23 depending on the mode), out[3] day of week, out[4] date,
+ * out[5] month and out[6] year. The 12 hour, PM and century bits are not part of the result.
+ */
+inline void bcd_decode_time(const uint8_t* regs, uint8_t out[7])
+{
+    uint64_t mask = BCD_TIME_MASK | (bcd_hours_mask(regs[2]) << 16);
+    uint64_t x = bcd_decode_lanes(bcd_load7(regs) & mask);
+    for(int i = 0; i < 7; i++) out[i] = static_cast<uint8_t>(x >> (8 * i));
+}
+
+/**
+ * Decodes the alarm registers 0x07 through 0x0D into decimal: out[0..3] are the seconds, minutes,
+ * hours and day/date of Alarm 1, out[4..6] the minutes, hours and day/date of Alarm 2. The AxMx,
+ * DY/DT, 12 hour and PM bits are not part of the result.
+ */
+inline void bcd_decode_alarms(const uint8_t* regs, uint8_t out[7])
+{
+    uint64_t mask = BCD_ALARM_MASK | (bcd_hours_mask(regs[2]) << 16) | (bcd_hours_mask(regs[5]) << 40);
+    uint64_t x = bcd_decode_lanes(bcd_load7(regs) & mask);
+    for(int i = 0; i < 7; i++) out[i] = static_cast<uint8_t>(x >> (8 * i));
+}
+
+/**
+ * Decodes the time registers of many register files at once, e.g. snapshots archived from several
+ * devices or replayed from a log. On little endian targets, with register files at least 8 bytes
+ * apart (a whole DS3231 register file is 19), every file but the last is loaded with one 8 byte
+ * read, which reaches into the next file, and stored with one 8 byte write, whose last byte the
+ * next file overwrites. bcd_decode_time() reads and writes the 7 bytes one by one instead, since
+ * it must not touch the byte after either block.
+ *
+ * @param files The first register file, each starts at register 0x00
+ * @param stride The distance in bytes between consecutive register files
+ * @param count The number of register files
+ * @param out Receives 7 decoded bytes per register file, laid out as for bcd_decode_time()
+ */
+inline void bcd_decode_time_batch(const uint8_t* files, size_t stride, size_t count, uint8_t (*out)[7])
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(stride >= 8)
+    {
+        for(; count > 1; count--, files += stride, out++)
+        {
+            uint64_t x;
+            memcpy(&x, files, sizeof(x));
+            x = bcd_decode_lanes(x & (BCD_TIME_MASK | (bcd_hours_mask(static_cast<uint8_t>(x >> 16)) << 16)));
+            memcpy(out, &x, sizeof(x));
+        }
+    }
+#endif
+    for(; count > 0; count--, files += stride, out++) bcd_decode_time(files, *out);
+}
+
+#endif
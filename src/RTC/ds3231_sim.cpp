@@ -0,0 +1,352 @@
+#include <iostream>
+#include <time.h>
+#include <math.h>
+
+#include "ds3231_sim.h"
+#include "rtc_time.h"
+#include "bcd.h"
+
+using namespace std;
+
+#define CONVERSION_TIME_NS      125000000LL     // typical tCONV from the datasheet
+#define CONVERSION_PERIOD_S     64              // the TCXO converts every 64 seconds
+
+/**
+ * Converts an hours register (time or alarm) to the hour of the day from 0 to 23.
+ */
+static uint8_t hours_24(uint8_t reg)
+{
+    if(!(reg & 0x40)) return bcd_to_decimal(reg & 0x3F);
+    uint8_t hours = bcd_to_decimal(reg & 0x1F) % 12;
+    return (reg & 0x20) ? hours + 12 : hours;
+}
+
+/**
+ * Encodes the hour of the day (0 to 23) in the format of the hours register passed in.
+ */
+static uint8_t encode_hours(uint8_t hours, uint8_t format_of)
+{
+    if(!(format_of & 0x40)) return decimal_to_bcd(hours);
+    uint8_t reg = 0x40 | decimal_to_bcd(hours % 12 == 0 ? 12 : hours % 12);
+    if(hours >= 12) reg |= 0x20;
+    return reg;
+}
+
+static uint8_t days_in_month(uint8_t month, uint8_t year)
+{
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if(month == 2 && year % 4 == 0) return 29;  // the DS3231 treats every fourth year as a leap year
+    return days[(month - 1) % 12];
+}
+
+/**
+ * Creates a simulator in the power-on state of the DS3231: 00:00:00 on 01/01/00, INTCN and RS2:RS1
+ * set in the control register, OSF and EN32kHz set in the status register and 25 degrees Celsius.
+ *
+ * @param freeRunning If true the time follows CLOCK_MONOTONIC, if false it only moves on advance().
+ */
+DS3231Simulator::DS3231Simulator(bool freeRunning)
+{
+    for(int i = 0; i < DS3231_NUM_REGISTERS; i++) this->regs[i] = 0;
+    this->regs[REG_TIME_DAY_OF_WEEK]   = 0x01;
+    this->regs[REG_TIME_DATE_OF_MONTH] = 0x01;
+    this->regs[REG_TIME_MONTH]         = 0x01;
+    this->regs[REG_CONTROL]            = MASK_INTERRUPT_CONTROL | MASK_RATE_SELECT_2 | MASK_RATE_SELECT_1;
+    this->regs[REG_STATUS]             = MASK_OSCILLATOR_STOP_FLAG | MASK_ENABLE_32KHZ_OUT;
+    this->freeRunning                  = freeRunning;
+    this->lastSyncNs                   = monotonic_ns();
+    this->subsecondNs                  = 0;
+    this->clockNs                      = 0;
+    this->conversionDoneNs             = -1;
+    this->secondsSinceConversion       = 0;
+    this->temperatureQuarters          = 25 * 4;
+    this->driftPpm                     = 0;
+    this->latchTemperature();
+}
+
+/**
+ * Brings a free running simulator up to the current CLOCK_MONOTONIC time.
+ */
+void DS3231Simulator::sync()
+{
+    if(!this->freeRunning) return;
+    int64_t now = monotonic_ns();
+    this->step(now - this->lastSyncNs);
+    this->lastSyncNs = now;
+}
+
+/**
+ * Moves the simulator time forward, running the seconds counter at the crystal rate that is
+ * set by the drift and trimmed by the aging offset (about 0.1ppm per LSB, positive is slower).
+ */
+void DS3231Simulator::step(int64_t nanoseconds)
+{
+    double rate = 1.0 + (this->driftPpm - 0.1 * static_cast<int8_t>(this->regs[REG_AGING_OFFSET])) * 1e-6;
+    // go from tick to tick, so that conversions started by a tick finish at the right time
+    while(true)
+    {
+        if(this->conversionDoneNs >= 0 && this->clockNs >= this->conversionDoneNs) this->latchTemperature();
+        int64_t toTick = static_cast<int64_t>(ceil((NS_PER_SECOND - this->subsecondNs) / rate));
+        if(this->conversionDoneNs >= 0 && this->conversionDoneNs - this->clockNs < toTick)
+            toTick = this->conversionDoneNs - this->clockNs;
+        if(nanoseconds < toTick) break;
+        this->clockNs += toTick;
+        nanoseconds -= toTick;
+        this->subsecondNs += toTick * rate;
+        if(this->subsecondNs >= NS_PER_SECOND)
+        {
+            this->subsecondNs -= NS_PER_SECOND;
+            this->tick();
+        }
+    }
+    this->clockNs += nanoseconds;
+    this->subsecondNs += nanoseconds * rate;
+}
+
+/**
+ * Increments the time registers by one second and runs the alarm comparison.
+ */
+void DS3231Simulator::tick()
+{
+    uint8_t seconds = bcd_to_decimal(this->regs[REG_TIME_SECONDS] & 0x7F) + 1;
+    uint8_t minutes = bcd_to_decimal(this->regs[REG_TIME_MINUTES] & 0x7F);
+    uint8_t hours   = hours_24(this->regs[REG_TIME_HOURS]);
+    uint8_t day     = bcd_to_decimal(this->regs[REG_TIME_DAY_OF_WEEK] & 0x07);
+    uint8_t date    = bcd_to_decimal(this->regs[REG_TIME_DATE_OF_MONTH] & 0x3F);
+    uint8_t month   = bcd_to_decimal(this->regs[REG_TIME_MONTH] & 0x1F);
+    uint8_t century = this->regs[REG_TIME_MONTH] & 0x80;
+    uint8_t year    = bcd_to_decimal(this->regs[REG_TIME_YEAR]);
+
+    if(seconds == 60) { seconds = 0; minutes++; }
+    if(minutes == 60) { minutes = 0; hours++; }
+    if(hours == 24)
+    {
+        hours = 0;
+        day = (day % 7) + 1;
+        date++;
+    }
+    if(date > days_in_month(month, year)) { date = 1; month++; }
+    if(month > 12)
+    {
+        month = 1;
+        year++;
+        if(year == 100) { year = 0; century ^= 0x80; }  // the century bit toggles when the year overflows
+    }
+
+    this->regs[REG_TIME_SECONDS]       = decimal_to_bcd(seconds);
+    this->regs[REG_TIME_MINUTES]       = decimal_to_bcd(minutes);
+    this->regs[REG_TIME_HOURS]         = encode_hours(hours, this->regs[REG_TIME_HOURS]);
+    this->regs[REG_TIME_DAY_OF_WEEK]   = decimal_to_bcd(day);
+    this->regs[REG_TIME_DATE_OF_MONTH] = decimal_to_bcd(date);
+    this->regs[REG_TIME_MONTH]         = century | decimal_to_bcd(month);
+    this->regs[REG_TIME_YEAR]          = decimal_to_bcd(year);
+    this->checkAlarms();
+
+    if(++this->secondsSinceConversion >= CONVERSION_PERIOD_S) this->startConversion();
+}
+
+/**
+ * Compares the time registers against both alarms and sets A1F/A2F on a match. A field takes part
+ * in the comparison only when its AxMx bit is clear, Alarm 2 is only compared at 00 seconds.
+ */
+void DS3231Simulator::checkAlarms()
+{
+    const uint8_t* t = this->regs;
+    bool dayMode, match;
+
+    // Alarm 1: 0x07 through 0x0A
+    const uint8_t* a1 = this->regs + REG_SECONDS_ALARM_1;
+    dayMode = a1[3] & MASK_ALARM_DAY_OR_DATEINV;
+    match = true;
+    if(!(a1[0] & MASK_ALARM_MODE)) match &= (a1[0] & MASK_ALARM_SECONDS) == (t[REG_TIME_SECONDS] & 0x7F);
+    if(!(a1[1] & MASK_ALARM_MODE)) match &= (a1[1] & MASK_ALARM_MINUTES) == (t[REG_TIME_MINUTES] & 0x7F);
+    if(!(a1[2] & MASK_ALARM_MODE)) match &= hours_24(a1[2] & 0x7F) == hours_24(t[REG_TIME_HOURS]);
+    if(!(a1[3] & MASK_ALARM_MODE))
+        match &= (a1[3] & MASK_ALARM_DAY_DATE) == (dayMode ? t[REG_TIME_DAY_OF_WEEK] : t[REG_TIME_DATE_OF_MONTH]);
+    if(match) this->regs[REG_STATUS] |= MASK_ALARM_1_FLAG;
+
+    // Alarm 2: 0x0B through 0x0D
+    if(t[REG_TIME_SECONDS] != 0) return;
+    const uint8_t* a2 = this->regs + REG_MINUTES_ALARM_2;
+    dayMode = a2[2] & MASK_ALARM_DAY_OR_DATEINV;
+    match = true;
+    if(!(a2[0] & MASK_ALARM_MODE)) match &= (a2[0] & MASK_ALARM_MINUTES) == (t[REG_TIME_MINUTES] & 0x7F);
+    if(!(a2[1] & MASK_ALARM_MODE)) match &= hours_24(a2[1] & 0x7F) == hours_24(t[REG_TIME_HOURS]);
+    if(!(a2[2] & MASK_ALARM_MODE))
+        match &= (a2[2] & MASK_ALARM_DAY_DATE) == (dayMode ? t[REG_TIME_DAY_OF_WEEK] : t[REG_TIME_DATE_OF_MONTH]);
+    if(match) this->regs[REG_STATUS] |= MASK_ALARM_2_FLAG;
+}
+
+/**
+ * Starts a temperature conversion, BSY (and CONV if it was requested) stay set until it finishes.
+ */
+void DS3231Simulator::startConversion()
+{
+    this->secondsSinceConversion = 0;
+    this->regs[REG_STATUS] |= MASK_BUSY;
+    this->conversionDoneNs = this->clockNs + CONVERSION_TIME_NS;
+}
+
+/**
+ * Finishes a temperature conversion: latches the temperature and clears BSY and CONV.
+ */
+void DS3231Simulator::latchTemperature()
+{
+    this->regs[REG_TEMPERATURE_MSB] = static_cast<uint8_t>(this->temperatureQuarters >> 2);
+    this->regs[REG_TEMPERATURE_LSB] = static_cast<uint8_t>((this->temperatureQuarters & 0x3) << 6);
+    this->regs[REG_STATUS]  &= ~(MASK_BUSY);
+    this->regs[REG_CONTROL] &= ~(MASK_CONV_TEMPERATURE);
+    this->conversionDoneNs = -1;
+}
+
+/**
+ * Reads a single register.
+ * @param registerAddress the address to read from
+ * @return the byte value at the register address.
+ */
+unsigned char DS3231Simulator::readRegister(unsigned int registerAddress)
+{
+    unsigned char value = 0;
+    this->readRegisters(registerAddress, &value, 1);
+    return value;
+}
+
+/**
+ * Reads a block of registers, the register pointer wraps from 0x12 back to 0x00 like on the chip.
+ * @param fromAddress the starting address to read from
+ * @param buffer the buffer that receives the register values
+ * @param number the number of registers to read
+ * @return 1 if the start address does not exist, 0 on success.
+ */
+int DS3231Simulator::readRegisters(unsigned int fromAddress, unsigned char* buffer, unsigned int number)
+{
+    if(fromAddress >= DS3231_NUM_REGISTERS) return 1;
+    lock_guard<mutex> guard(this->lock);
+    this->sync();
+    for(unsigned int i = 0; i < number; i++)
+        buffer[i] = this->regs[(fromAddress + i) % DS3231_NUM_REGISTERS];
+    return 0;
+}
+
+/**
+ * Writes a single register.
+ * @param registerAddress The register address
+ * @param value The value to be written to the register
+ * @return 1 if the register does not exist, 0 on success.
+ */
+int DS3231Simulator::writeRegister(unsigned int registerAddress, unsigned char value)
+{
+    return this->writeRegisters(registerAddress, &value, 1);
+}
+
+/**
+ * Writes a block of registers with the same side effects as the chip: writing the seconds resets
+ * the countdown chain, CONV starts a conversion, the status flags can only be cleared, and BSY
+ * and the temperature registers are read only.
+ * @param fromAddress The address of the first register to write
+ * @param values The values to be written
+ * @param number The number of registers to write
+ * @return 1 if the start address does not exist, 0 on success.
+ */
+int DS3231Simulator::writeRegisters(unsigned int fromAddress, const unsigned char* values, unsigned int number)
+{
+    if(fromAddress >= DS3231_NUM_REGISTERS) return 1;
+    lock_guard<mutex> guard(this->lock);
+    this->sync();
+    for(unsigned int i = 0; i < number; i++)
+    {
+        unsigned int reg = (fromAddress + i) % DS3231_NUM_REGISTERS;
+        uint8_t value = values[i];
+        switch(reg)
+        {
+        case REG_TIME_SECONDS:
+            this->regs[reg] = value & 0x7F;
+            this->subsecondNs = 0;
+            break;
+
+        case REG_CONTROL:
+            if((value & MASK_CONV_TEMPERATURE) && !(this->regs[REG_STATUS] & MASK_BUSY))
+            {
+                this->regs[reg] = value;
+                this->startConversion();
+            }
+            else this->regs[reg] = (value & ~MASK_CONV_TEMPERATURE) | (this->regs[reg] & MASK_CONV_TEMPERATURE);
+            break;
+
+        case REG_STATUS:
+        {
+            uint8_t flags = MASK_OSCILLATOR_STOP_FLAG | MASK_ALARM_2_FLAG | MASK_ALARM_1_FLAG;
+            uint8_t kept  = this->regs[reg] & (value | ~flags) & (flags | MASK_BUSY);
+            this->regs[reg] = kept | (value & MASK_ENABLE_32KHZ_OUT);
+            break;
+        }
+
+        case REG_TEMPERATURE_MSB:
+        case REG_TEMPERATURE_LSB:
+            break;
+
+        default:
+            this->regs[reg] = value;
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Nothing to release for the model, provided for the BusDevice interface.
+ */
+void DS3231Simulator::close()
+{
+}
+
+/**
+ * Moves the simulator time forward, running every seconds increment, alarm match and temperature
+ * conversion that falls in the interval.
+ * @param nanoseconds the time to advance by
+ */
+void DS3231Simulator::advance(int64_t nanoseconds)
+{
+    lock_guard<mutex> guard(this->lock);
+    this->step(nanoseconds);
+}
+
+/**
+ * Sets the temperature that the next conversion latches into 0x11 and 0x12.
+ * @param quarters the temperature in units of 0.25 degrees Celsius
+ */
+void DS3231Simulator::setTemperature(int16_t quarters)
+{
+    lock_guard<mutex> guard(this->lock);
+    this->temperatureQuarters = quarters;
+}
+
+/**
+ * Sets the frequency error of the simulated crystal, positive runs fast.
+ * @param ppm the error in parts per million before the aging offset is applied
+ */
+void DS3231Simulator::setDriftPpm(double ppm)
+{
+    lock_guard<mutex> guard(this->lock);
+    this->driftPpm = ppm;
+}
+
+/**
+ * Returns the level of the INT/SQW pin in interrupt mode, it is asserted (low) while an enabled
+ * alarm has its flag set.
+ * @return true if the interrupt output is asserted
+ */
+bool DS3231Simulator::interruptAsserted()
+{
+    lock_guard<mutex> guard(this->lock);
+    this->sync();
+    uint8_t control = this->regs[REG_CONTROL];
+    uint8_t status  = this->regs[REG_STATUS];
+    if(!(control & MASK_INTERRUPT_CONTROL)) return false;
+    return ((control & MASK_ALARM_1_INT_ENABLE) && (status & MASK_ALARM_1_FLAG)) ||
+           ((control & MASK_ALARM_2_INT_ENABLE) && (status & MASK_ALARM_2_FLAG));
+}
+
+DS3231Simulator::~DS3231Simulator()
+{
+}
@@ -0,0 +1,53 @@
+#ifndef DS3231_SIM_H_
+#define DS3231_SIM_H_
+
+#include "rtc.h"
+#include <stdint.h>
+#include <mutex>
+
+/**
+ * @class DS3231Simulator
+ * @brief Software model of the DS3231 register file that can stand in for the I2C bus.
+ *
+ * It models the register pointer auto-increment, BCD time keeping (12/24 hour mode, month
+ * lengths, leap years and the century bit), alarm matching with the A1Mx/A2Mx mask bits and
+ * the A1F/A2F flags, the write-to-clear status flags, the temperature registers with the
+ * 64 second and CONV triggered conversions, and the aging offset's effect on the rate.
+ *
+ * A free running simulator follows CLOCK_MONOTONIC, otherwise time only moves on advance().
+ */
+class DS3231Simulator: public EE513::BusDevice {
+private:
+    uint8_t regs[DS3231_NUM_REGISTERS];
+    std::mutex lock;
+    bool freeRunning;
+    int64_t lastSyncNs;             // CLOCK_MONOTONIC of the last sync() in free running mode
+    double subsecondNs;             // time elapsed since the last seconds increment
+    int64_t clockNs;                // simulator time, used for the temperature conversions
+    int64_t conversionDoneNs;       // end of the running temperature conversion, -1 if none
+    int secondsSinceConversion;
+    int16_t temperatureQuarters;    // temperature that the next conversion latches
+    double driftPpm;                // crystal error before the aging offset is applied
+
+    void sync();
+    void step(int64_t nanoseconds);
+    void tick();
+    void checkAlarms();
+    void startConversion();
+    void latchTemperature();
+
+public:
+    DS3231Simulator(bool freeRunning = true);
+    virtual unsigned char readRegister(unsigned int registerAddress);
+    virtual int readRegisters(unsigned int fromAddress, unsigned char* buffer, unsigned int number);
+    virtual int writeRegister(unsigned int registerAddress, unsigned char value);
+    virtual int writeRegisters(unsigned int fromAddress, const unsigned char* values, unsigned int number);
+    virtual void close();
+    void advance(int64_t nanoseconds);
+    void setTemperature(int16_t quarters);
+    void setDriftPpm(double ppm);
+    bool interruptAsserted();
+    virtual ~DS3231Simulator();
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LINEAR_FIT_H_
+#define LINEAR_FIT_H_
+
+/**
+ * @class LinearFit
+ * @brief Incremental least squares fit of a straight line y = a + b * t, in O(1) memory.
+ *
+ * Only the weighted sums are kept, so samples can be added for as long as needed without storing
+ * them. A decay below 1 scales the sums down before each sample is added, which makes the fit
+ * exponentially forget old samples, e.g. decay = exp(-interval / timeConstant). The time axis is
+ * kept relative to the first sample so that the sums stay well conditioned.
+ */
+class LinearFit {
+private:
+    double t0;              // time of the first sample, the origin of the sums
+    double w, st, sy, stt, sty;
+    unsigned int n;
+    double firstT, lastT;
+
+public:
+    LinearFit() { this->reset(); }
+
+    void reset()
+    {
+        this->t0 = this->w = this->st = this->sy = this->stt = this->sty = 0;
+        this->firstT = this->lastT = 0;
+        this->n = 0;
+    }
+
+    void add(double t, double y, double decay = 1.0)
+    {
+        if(this->n == 0) this->t0 = this->firstT = t;
+        double x = t - this->t0;
+        this->w   = this->w   * decay + 1;
+        this->st  = this->st  * decay + x;
+        this->sy  = this->sy  * decay + y;
+        this->stt = this->stt * decay + x * x;
+        this->sty = this->sty * decay + x * y;
+        this->lastT = t;
+        this->n++;
+    }
+
+    unsigned int count() const { return this->n; }
+    double span() const { return this->lastT - this->firstT; }
+    double lastTime() const { return this->lastT; }
+
+    // the slope b, 0 until two samples at different times have been added
+    double slope() const
+    {
+        double d = this->w * this->stt - this->st * this->st;
+        if(this->n < 2 || d <= 0) return 0;
+        return (this->w * this->sty - this->st * this->sy) / d;
+    }
+
+    // the fitted line at time t
+    double valueAt(double t) const
+    {
+        if(this->n == 0) return 0;
+        double b = this->slope();
+        double meanT = this->st / this->w;
+        double meanY = this->sy / this->w;
+        return meanY + b * (t - this->t0 - meanT);
+    }
+};
+
+#endif
@@ -4,8 +4,12 @@
 #include <stdio.h>
 #include <iomanip>
 #include <memory>
+#include <math.h>
 
 #include "rtc.h"
+#include "bcd.h"
+#include "rtc_time.h"
+#include "rtc_registers.h"
 
 using namespace std;
 
@@ -17,57 +21,239 @@ using namespace std;
  * @param device Represents the device address of the RTC (Real-Time Clock) module. This address is used to communicate with the
  * RTC module over the I2C bus.
  */
-RTC::RTC(unsigned int bus, unsigned int device) : I2CDevice(bus, device)
+RTC::RTC(unsigned int bus, unsigned int device) : i2c(new EE513::I2CDevice(bus, device)), shadowValid(false), conversionRunning(false)
 {
 }
 
 /**
- * Converts a BCD (Binary-Coded Decimal) value to its decimal equivalent.
+ * The RTC constructor initializes an instance of the RTC class on top of an already constructed
+ * bus backend, e.g. a DS3231Simulator to run the driver on a machine without the module.
  * 
- * @param BCD_value An 8-bit unsigned integer that represents a binary-coded decimal value.
+ * @param device The bus backend that the RTC takes ownership of.
+ */
+RTC::RTC(std::unique_ptr<EE513::BusDevice> device) : i2c(std::move(device)), shadowValid(false), conversionRunning(false)
+{
+}
+
+/**
+ * Reads a block of registers in one transaction, with the bus to itself.
  * 
- * @return the decimal value of the BCD (Binary-Coded Decimal) value passed as an argument.
+ * @param fromAddress The address of the first register
+ * @param buffer Receives the registers
+ * @param number The number of registers to read
+ * 
+ * @return 0 if successful, 1 if unsuccessful
  */
-uint8_t RTC::BCD_to_decimal(uint8_t BCD_value)
+int RTC::busRead(unsigned int fromAddress, unsigned char* buffer, unsigned int number)
 {
-    uint8_t res = BCD_value & 0xF;          // Extract the BCD nibble
-    res += 10 * (BCD_value >> 4);           // Add the nibbles to consecutive order of 10
-    return res;
+    lock_guard<mutex> guard(this->busLock);
+    return this->i2c->readRegisters(fromAddress, buffer, number);
 }
 
 /**
- * Reads time data from registers and stores it in a `user_time_t` pointed to by `user_time_ptr_t`
+ * Writes a block of registers in one transaction, with the bus to itself.
+ * 
+ * @param fromAddress The address of the first register
+ * @param values The values to write
+ * @param number The number of registers to write
  * 
- * @return A pointer to a memory sage shared pointer user_time_ptr_t
+ * @return 0 if successful, 1 if unsuccessful
  */
-user_time_ptr_t RTC::getTime()
+int RTC::busWrite(unsigned int fromAddress, const unsigned char* values, unsigned int number)
 {
-    user_time_ptr_t t (new user_time_t);                // Create a new user_time_t with a pointer declaration
-    if (t.get() == nullptr)
+    lock_guard<mutex> guard(this->busLock);
+    return this->i2c->writeRegisters(fromAddress, values, number);
+}
+
+/**
+ * Loads the shadow copy of registers 0x00 through 0x12 in a single burst, unless it is already valid.
+ * The alarm, control and aging registers are only changed by this driver, so once loaded they are
+ * served and modified locally. The time, the status flags, BSY, CONV and the temperature change on
+ * their own and are always read from the chip when they are needed.
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::loadShadow()
+{
+    if(this->shadowValid) return 0;
+    if(this->busRead(REG_TIME_SECONDS, this->shadow, DS3231_NUM_REGISTERS))
     {
-        cerr << "RTC: NO MEMORY AVAILABLE to allocate user_time_t* t" << endl;
-        return nullptr;
+        cerr << "RTC: Unable to read the register file" << endl;
+        return 1;
     }
-    unsigned char *data = this->readRegisters(7, 0x00); // Read from registers 0x00 through 0x07
-    t->seconds          = this->BCD_to_decimal(data[0]);// Extract seconds
-    t->minutes          = this->BCD_to_decimal(data[1]);// Extract minutes
+    this->shadow[REG_CONTROL] &= ~(MASK_CONV_TEMPERATURE); // CONV clears itself, never write it back
+    this->shadowValid = true;
+    return 0;
+}
 
-    // evalute if 12 hr clock or 24 hr clock
-    if(data[2] & 0x40) t->clock_12hr = FORMAT_0_12;
-    if(t->clock_12hr)
+/**
+ * Writes a block of registers through the shadow copy. Only the range between the first and the
+ * last register that actually changes is sent, as a single burst, and nothing is sent if the
+ * values are already in the registers.
+ * 
+ * @param fromAddress The address of the first register of the block
+ * @param values The new values of the block
+ * @param number The number of registers in the block
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::writeShadow(uint8_t fromAddress, const uint8_t* values, uint8_t number)
+{
+    if(this->loadShadow()) return 1;
+    int first = -1, last = -1;
+    for(int i = 0; i < number; i++)
     {
-        if((data[2] & 0x20) >> 5) t->am_pm        = PM; // if 1 then PM, else AM
-        else t->am_pm       = AM;
-        t->hours        = this->BCD_to_decimal(data[2] & 0x1F); // Extract hours (if 12 hour clock)
+        if(this->shadow[fromAddress + i] == values[i]) continue;
+        if(first < 0) first = i;
+        last = i;
     }
-    else t->hours       = this->BCD_to_decimal(data[2] & 0x3F); // Extract hours (if 24 hour clock)
+    if(first < 0) return 0;
+    if(this->busWrite(fromAddress + first, values + first, last - first + 1))
+    {
+        this->shadowValid = false;  // the chip may hold part of the burst, read it again next time
+        return 1;
+    }
+    for(int i = first; i <= last; i++) this->shadow[fromAddress + i] = values[i];
+    return 0;
+}
+
+/**
+ * Clears and sets bits of a single register using the shadow copy instead of a read-modify-write
+ * on the bus, so a change costs one write and no change costs nothing.
+ * 
+ * @param registerAddress The register to modify
+ * @param clearMask The bits to clear
+ * @param setMask The bits to set, applied after clearMask
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::modifyRegister(uint8_t registerAddress, uint8_t clearMask, uint8_t setMask)
+{
+    if(this->loadShadow()) return 1;
+    uint8_t value = (this->shadow[registerAddress] & ~clearMask) | setMask;
+    return this->writeShadow(registerAddress, &value, 1);
+}
+
+/**
+ * Writes the status register in a single transaction without reading it first. The OSF, A2F and
+ * A1F flags can only be cleared by writing a 0, writing a 1 leaves them untouched, so every flag
+ * that is not in clearFlags is written as 1. EN32kHz is taken from the shadow copy.
+ * 
+ * @param clearFlags The flags to clear, any of MASK_OSCILLATOR_STOP_FLAG, MASK_ALARM_2_FLAG, MASK_ALARM_1_FLAG
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::writeStatus(uint8_t clearFlags)
+{
+    if(this->loadShadow()) return 1;
+    uint8_t flags = MASK_OSCILLATOR_STOP_FLAG | MASK_ALARM_2_FLAG | MASK_ALARM_1_FLAG;
+    uint8_t value = (this->shadow[REG_STATUS] & MASK_ENABLE_32KHZ_OUT) | (flags & ~clearFlags);
+    return this->busWrite(REG_STATUS, &value, 1);
+}
 
-    t->day_of_week      = this->BCD_to_decimal(data[3]); // Extract the day of the week
-    t->date_of_month    = this->BCD_to_decimal(data[4]); // Extract the date of the month
-    t->month            = this->BCD_to_decimal(data[5] & 0x1F); // Extract the month
-    t->year             = this->BCD_to_decimal(data[6]); // Extract the year (from 2000, e.g, if 2020 then 20)
-    delete []data;
-    return t;
+/**
+ * Drops the shadow copy of the register file so that the next access reads it from the chip again.
+ * Call it when something other than this object may have written to the DS3231.
+ */
+void RTC::invalidateCache()
+{
+    this->shadowValid = false;
+}
+
+/**
+ * Converts a BCD (Binary-Coded Decimal) value to its decimal equivalent with a table lookup.
+ * 
+ * @param BCD_value An 8-bit unsigned integer that represents a binary-coded decimal value.
+ * 
+ * @return the decimal value of the BCD (Binary-Coded Decimal) value passed as an argument.
+ */
+uint8_t RTC::BCD_to_decimal(uint8_t BCD_value)
+{
+    return bcd_to_decimal(BCD_value);
+}
+
+/**
+ * Decodes the time registers 0x00 through 0x06 into a `user_time_t`, every field is written.
+ * All seven registers are converted from BCD at once with bcd_decode_time().
+ * 
+ * @param data The seven time registers, starting with the seconds
+ * @param t The `user_time_t` to fill
+ */
+void RTC::decodeTime(const uint8_t* data, user_time_t& t)
+{
+    uint8_t decimal[7];
+    bcd_decode_time(data, decimal);
+    t.seconds          = decimal[0];
+    t.minutes          = decimal[1];
+    t.hours            = decimal[2];   // 1-12 in 12 hour mode, 0-23 in 24 hour mode
+
+    // evalute if 12 hr clock or 24 hr clock
+    t.clock_12hr = field_time_clock_12hr::get(data);
+    t.am_pm      = t.clock_12hr ? field_time_am_pm::get(data) : AM;    // the PM bit only counts in 12 hour mode
+
+    t.day_of_week      = decimal[3];
+    t.date_of_month    = decimal[4];
+    t.month            = decimal[5];
+    t.year             = decimal[6];   // the year from 2000, e.g, if 2020 then 20
+}
+
+/**
+ * Reads the time registers in a single transaction and stores them in a `user_time_t` owned by the
+ * caller. It performs no heap allocation.
+ * 
+ * @param t The `user_time_t` to fill, every field is written
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getTime(user_time_t& t)
+{
+    unsigned char data[7];
+    if(this->busRead(REG_TIME_SECONDS, data, 7)) return 1; // Read from registers 0x00 through 0x06
+    this->decodeTime(data, t);
+    return 0;
+}
+
+/**
+ * Reads only the seconds register, the shortest transaction that shows the seconds rollover.
+ * 
+ * @param seconds Receives the seconds from 0 to 59
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getSeconds(uint8_t& seconds)
+{
+    unsigned char data;
+    if(this->busRead(REG_TIME_SECONDS, &data, 1)) return 1;
+    seconds = field_time_seconds::decode(data);
+    return 0;
+}
+
+/**
+ * Reads the time registers in a single transaction and converts them to seconds since the epoch,
+ * taking the century bit into account.
+ * 
+ * @param epoch Receives the RTC time (UTC) as seconds since the epoch
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getEpoch(time_t& epoch)
+{
+    unsigned char data[7];
+    if(this->busRead(REG_TIME_SECONDS, data, 7)) return 1;
+    epoch = static_cast<time_t>(rtc_registers_to_epoch(data));
+    return 0;
+}
+
+/**
+ * Reads time data from registers and stores it in a `user_time_t` pointed to by `user_time_ptr_t`
+ * 
+ * @return A pointer to a memory sage shared pointer user_time_ptr_t, nullptr if the read failed
+ */
+user_time_ptr_t RTC::getTime()
+{
+    user_time_t t;
+    if(this->getTime(t)) return nullptr;
+    return std::make_shared<user_time_t>(t);
 }
 
 /**
@@ -92,51 +278,55 @@ user_time_ptr_t RTC::getTime()
  */
 int RTC::setTime(uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, uint8_t day_of_week, uint8_t date_of_month, uint8_t month, uint8_t year)
 {
-    int res = this->writeRegister(REG_TIME_SECONDS, this->decimal_to_BCD(seconds)); // Write to 0x00 the seconds
-    if(res) return res;
-    res = this->writeRegister(REG_TIME_MINUTES, this->decimal_to_BCD(minutes)); // Write to 0x01 the minutes 
-    if(res) return res;
+    // 0x00 through 0x06 but the hours, whose fields depend on the clock format
+    typedef rtc_burst<field_time_seconds, field_time_minutes, field_time_day_of_week,
+                      field_time_date_of_month, field_time_month, field_time_year> burst_time;
+    burst_time::block_t regs = burst_time::encode(seconds, minutes, day_of_week, date_of_month, month, year);
     // Check if the clock format is 12 hour or 24 hour
     if(clock_12_hr)
     {
-        uint8_t reg_value = this->decimal_to_BCD(hours) | 0x40; // Set the 12 hour clock bit
-        if(am_pm) reg_value |= 0x20;                            // if AM, set the PM bit
-        res = this->writeRegister(REG_TIME_HOURS, reg_value);   // Write the hours to 0x02
-        if(res) return res;
+        field_time_clock_12hr::set(regs.data(), FORMAT_0_12);  // Set the 12 hour clock bit
+        field_time_am_pm::set(regs.data(), am_pm);             // if PM, set the PM bit
+        field_time_hours_12::set(regs.data(), hours);
     }
     // if 24 hour clock
-    else {
-        res = this->writeRegister(REG_TIME_HOURS, this->decimal_to_BCD(hours));
-        if(res) return res;
-    }
-    res = this->writeRegister(REG_TIME_DAY_OF_WEEK, this->decimal_to_BCD(day_of_week)); // Set the day of the week to 0x03
-    if(res) return res;
-    res = this->writeRegister(REG_TIME_DATE_OF_MONTH, this->decimal_to_BCD(date_of_month)); // Set the date of the month to 0x04
-    if(res) return res;
-    res = this->writeRegister(REG_TIME_MONTH, this->decimal_to_BCD(month)); // Set the month to 0x05
-    if(res) return res;
-    res = this->writeRegister(REG_TIME_YEAR, this->decimal_to_BCD(year)); // Set the year to 0x06
-    if(res) return res;
+    else field_time_hours_24::set(regs.data(), hours);
+    return this->writeTimeRegisters(regs.data());
+}
+
+/**
+ * Writes the time registers 0x00 through 0x06 in one transaction, so the seconds cannot roll over
+ * halfway through, and keeps the shadow copy of them current.
+ * 
+ * @param regs The seven encoded time registers, starting with the seconds
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::writeTimeRegisters(const uint8_t* regs)
+{
+    int res = this->busWrite(REG_TIME_SECONDS, regs, 7);
+    if(res) cerr << "RTC: Unable to set the time" << endl;
+    else for(int i = 0; i < 7; i++) this->shadow[REG_TIME_SECONDS + i] = regs[i];
     return res;
 }
 
 /**
- * Converts a decimal number to binary-coded decimal (BCD) format.
+ * Converts a decimal number to binary-coded decimal (BCD) format with a table lookup.
  * 
  * @param decimal The decimal parameter is an unsigned 8-bit integer that represents a decimal number.
  * 
  * @return a uint8_t value, which is the result of converting a decimal number to BCD (Binary-Coded
- * Decimal) format.
+ * Decimal) format, 0xFF if the number is above 99.
  */
 uint8_t RTC::decimal_to_BCD(uint8_t decimal)
 {
-    uint8_t res = (decimal/10) << 4; // Extract the higher BCD nibble
-    res |= decimal%10;              // bitwise AND with the lower nibble
-    return res;
+    return decimal_to_bcd(decimal);
 }
 
 /**
- * Sets the current system time to the RTC
+ * Sets the current system time to the RTC, as UTC. The registers are encoded straight from
+ * CLOCK_REALTIME with rtc_epoch_to_registers(), without localtime() and its time zone lookups,
+ * and written in a single transaction.
  * 
  * @param clock_12_hr The `clock_12_hr` parameter is used to determine whether the time should be set
  * in 12-hour format or 24-hour format.
@@ -145,85 +335,428 @@ uint8_t RTC::decimal_to_BCD(uint8_t decimal)
  */
 int RTC::setCurrentTimeToRTC(CLOCK_FORMAT clock_12_hr)
 {
-    time_t now = time(0);                   // Use the time library to get the current time
-    struct tm tstruct;                      // stores the time
-    tstruct = *localtime(&now);             // convert to local time representation
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);    // the current system time
+    uint8_t regs[7];
+    rtc_epoch_to_registers(now.tv_sec, clock_12_hr, regs);
+    if(this->writeTimeRegisters(regs))
+    {
+        cerr << "RTC: Unable to write system time to module" << endl;
+        return 1;
+    }
+    return 0;
+}
 
-    int seconds         = tstruct.tm_sec;   // store the seconds
-    int minutes         = tstruct.tm_min;   // store the minutes
-    AM_OR_PM am_pm      = AM;               // initialize AM or PM
-    int hours;
-    // if 24 hour clock
-    if(!clock_12_hr)
+/**
+ * Sets the current system time to the RTC at a system clock second boundary, as UTC. The registers
+ * for the next whole second are encoded beforehand, the thread sleeps until that second starts on
+ * CLOCK_REALTIME and the time block is written in a single transaction. Writing the seconds register
+ * restarts the countdown chain of the DS3231, so its seconds then roll over with those of the system
+ * clock, give or take the bus latency. SecondsEdgeDetector::setTimeAligned() calls this and verifies
+ * the result by measuring the residual offset.
+ * 
+ * @param clock_12_hr The `clock_12_hr` parameter is used to determine whether the time should be set
+ * in 12-hour format or 24-hour format.
+ * @param leadNs How much earlier than the boundary to start the write, to make up for the time the
+ * transaction takes to reach the seconds register. Feed back the measured residual offset to tune it.
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::setCurrentTimeToRTCAligned(CLOCK_FORMAT clock_12_hr, int64_t leadNs)
+{
+    const int64_t minimumSleepNs = 2000000LL;  // leaves time to encode before the boundary
+    uint8_t regs[7];
+    struct timespec now;
+    for(int attempt = 0; attempt < 3; attempt++)
     {
-        hours           = tstruct.tm_hour;  // store the hours 
-    } 
-    // if 12 hour clock
-    else 
+        clock_gettime(CLOCK_REALTIME, &now);
+        int64_t nowNs = static_cast<int64_t>(now.tv_sec) * NS_PER_SECOND + now.tv_nsec;
+        int64_t target = now.tv_sec + 1;
+        if(target * NS_PER_SECOND - leadNs - nowNs < minimumSleepNs) target++;
+        rtc_epoch_to_registers(target, clock_12_hr, regs);
+
+        int64_t wakeNs = target * NS_PER_SECOND - leadNs;
+        if(sleep_until_ns(CLOCK_REALTIME, wakeNs))
+        {
+            cerr << "RTC: Unable to wait for the second boundary" << endl;
+            return 1;
+        }
+
+        // a step of the system clock while asleep makes the encoded second wrong, plan again
+        clock_gettime(CLOCK_REALTIME, &now);
+        nowNs = static_cast<int64_t>(now.tv_sec) * NS_PER_SECOND + now.tv_nsec;
+        if(nowNs - wakeNs > NS_PER_SECOND / 2) continue;
+        if(this->writeTimeRegisters(regs))
+        {
+            cerr << "RTC: Unable to write system time to module" << endl;
+            return 1;
+        }
+        return 0;
+    }
+    cerr << "RTC: The system clock kept stepping, the time was not set" << endl;
+    return 1;
+}
+
+/**
+ * Decodes the temperature registers 0x11 and 0x12, a two's complement value in units of 0.25
+ * degrees Celsius with the fraction in the top two bits of 0x12.
+ * 
+ * @param regs The two temperature registers, MSB first
+ * 
+ * @return the temperature in quarter degrees Celsius
+ */
+int16_t RTC::decodeTemperature(const uint8_t* regs)
+{
+    return static_cast<int16_t>(field_temperature_integer::get(regs, REG_TEMPERATURE_MSB) * 4 +
+                                field_temperature_quarters::get(regs, REG_TEMPERATURE_MSB));
+}
+
+/**
+ * Reads the temperature as a fixed point value. MSB and LSB are read in a single transaction, so
+ * they always come from the same conversion.
+ * 
+ * @param quarters Receives the temperature in quarter degrees Celsius, e.g. 101 for 25.25
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getTemperatureQuarters(int16_t& quarters)
+{
+    unsigned char data[2];
+    if(this->busRead(REG_TEMPERATURE_MSB, data, 2))
+    {
+        cerr << "RTC: Unable to read the temperature" << endl;
+        return 1;
+    }
+    quarters = this->decodeTemperature(data);
+    return 0;
+}
+
+/**
+ * Starts a temperature conversion by setting CONV, unless one is already running (BSY or CONV set),
+ * which the datasheet asks to let finish. Control and status are read in a single transaction.
+ * 
+ * @return 0 if a conversion is running, 1 if unsuccessful
+ */
+int RTC::startTemperatureConversion()
+{
+    unsigned char data[2];
+    if(this->loadShadow() || this->busRead(REG_CONTROL, data, 2))
+    {
+        cerr << "RTC: Unable to read the conversion state" << endl;
+        return 1;
+    }
+    if((data[0] & MASK_CONV_TEMPERATURE) || (data[1] & MASK_BUSY)) return 0;
+    // CONV is never kept in the shadow copy, it clears itself once the conversion is done
+    uint8_t control = this->shadow[REG_CONTROL] | MASK_CONV_TEMPERATURE;
+    if(this->busWrite(REG_CONTROL, &control, 1))
+    {
+        cerr << "RTC: Unable to start a temperature conversion" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Runs on conversionThread: waits out the typical conversion time, then polls control, status
+ * and temperature in one burst until CONV and BSY have cleared, and hands the temperature of that
+ * same burst to every waiting callback. Only the bus is touched, never the shadow copy.
+ * 
+ * @param timeoutMs How long to wait for the conversion before reporting a failure
+ */
+void RTC::waitTemperatureConversion(int timeoutMs)
+{
+    const int firstPollMs = 100, pollMs = 5;   // tCONV is 125ms typical, 200ms at most
+    temperature_conversion_t result = {1, 0};
+    unsigned char data[REG_TEMPERATURE_LSB - REG_CONTROL + 1];
+    this_thread::sleep_for(chrono::milliseconds(firstPollMs < timeoutMs ? firstPollMs : timeoutMs));
+    for(int waitedMs = firstPollMs; ; waitedMs += pollMs)
     {
-        if(tstruct.tm_hour > 12)            // if hours > 12, then PM
+        if(this->busRead(REG_CONTROL, data, sizeof(data))) break;
+        if(!(data[0] & MASK_CONV_TEMPERATURE) && !(data[1] & MASK_BUSY))
         {
-            hours   = tstruct.tm_hour - 12; // hours in PM
-            am_pm   = PM;
-        } else
+            result.status   = 0;
+            result.quarters = this->decodeTemperature(data + REG_TEMPERATURE_MSB - REG_CONTROL);
+            break;
+        }
+        if(waitedMs >= timeoutMs) break;
+        this_thread::sleep_for(chrono::milliseconds(pollMs));
+    }
+    if(result.status) cerr << "RTC: The temperature conversion did not complete" << endl;
+
+    vector<temperature_callback_t> waiters;
+    {
+        lock_guard<mutex> guard(this->conversionLock);
+        waiters.swap(this->conversionWaiters);
+        this->conversionRunning = false;
+    }
+    for(size_t i = 0; i < waiters.size(); i++) waiters[i](result);
+}
+
+/**
+ * Requests a fresh temperature without blocking: CONV is set and the call returns, the callback
+ * runs on a background thread once BSY and CONV have cleared. Requests made while a conversion is
+ * running share its result instead of starting another one. The background thread only touches
+ * the bus, through busRead(), so the caller may keep using the RTC meanwhile. The callback must
+ * not call back into the RTC, which is not thread safe otherwise.
+ * 
+ * @param callback Called with the result, from the background thread
+ * @param timeoutMs How long to wait for the conversion before reporting a failure
+ * 
+ * @return 0 if the conversion was requested, 1 if unsuccessful (the callback is not called)
+ */
+int RTC::requestTemperatureConversion(temperature_callback_t callback, int timeoutMs)
+{
+    {
+        lock_guard<mutex> guard(this->conversionLock);
+        if(this->conversionRunning)
         {
-           hours = tstruct.tm_hour;         // hours in AM
-           am_pm = AM;
+            this->conversionWaiters.push_back(callback);
+            return 0;
         }
+        this->conversionRunning = true;     // requests from now on wait for this conversion
     }
-    int day_of_week     = tstruct.tm_wday+1;    // store day of the week
-    int date_of_month   = tstruct.tm_mday;      // store the date of the month
-    int month           = tstruct.tm_mon + 1;   // store the month
-    int year            = tstruct.tm_year % 100;// store the year mod by 100 (0-99)
-    
-    // Set the time using the private function
-    if(this->setTime(seconds, minutes, clock_12_hr, am_pm, hours, day_of_week, date_of_month, month, year))
+    // the bus and the shadow copy are used without conversionLock, which the worker takes to finish
+    int res = this->startTemperatureConversion();
+    if(this->conversionThread.joinable()) this->conversionThread.join();    // it has already finished
+    vector<temperature_callback_t> failed;
     {
-        cerr << "RTC: Unable to write system time to module" << endl;
+        lock_guard<mutex> guard(this->conversionLock);
+        if(res)
+        {
+            failed.swap(this->conversionWaiters);
+            this->conversionRunning = false;
+        }
+        else
+        {
+            this->conversionWaiters.push_back(callback);
+            this->conversionThread = thread(&RTC::waitTemperatureConversion, this, timeoutMs);
+        }
+    }
+    // requests that joined while the conversion was being started learn that it failed
+    for(size_t i = 0; i < failed.size(); i++) failed[i](temperature_conversion_t{1, 0});
+    return res;
+}
+
+/**
+ * Requests a fresh temperature without blocking, see requestTemperatureConversion(callback).
+ * 
+ * @param timeoutMs How long to wait for the conversion before reporting a failure
+ * 
+ * @return a future that becomes ready with the result once the conversion completes
+ */
+future<temperature_conversion_t> RTC::requestTemperatureConversion(int timeoutMs)
+{
+    shared_ptr<promise<temperature_conversion_t>> done = make_shared<promise<temperature_conversion_t>>();
+    future<temperature_conversion_t> result = done->get_future();
+    if(this->requestTemperatureConversion([done](const temperature_conversion_t& r) { done->set_value(r); }, timeoutMs))
+        done->set_value(temperature_conversion_t{1, 0});
+    return result;
+}
+
+/**
+ * Reads the temperature together with BSY, status through temperature in a single transaction,
+ * so the caller knows whether a conversion was running when the value was read.
+ * 
+ * @param quarters Receives the temperature in quarter degrees Celsius
+ * @param busy Receives BSY, true while the TCXO is converting
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getTemperatureQuarters(int16_t& quarters, bool& busy)
+{
+    unsigned char data[REG_TEMPERATURE_LSB - REG_STATUS + 1];
+    if(this->busRead(REG_STATUS, data, sizeof(data)))
+    {
+        cerr << "RTC: Unable to read the temperature" << endl;
         return 1;
     }
+    busy     = data[0] & MASK_BUSY;
+    quarters = this->decodeTemperature(data + REG_TEMPERATURE_MSB - REG_STATUS);
     return 0;
 }
 
 /**
  * Reads the temperature from a register and stores it as a floating point number
  * 
- * @return the temperature value as a float.
+ * @return the temperature value as a float, NAN if it could not be read.
  */
 float RTC::getTemperature()
 {
-    unsigned char temp_reg_value = this->readRegister(REG_TEMPERATURE_MSB);
-    float temp_msb = static_cast<float>(temp_reg_value & 0x7F);   // store the MSB
-    unsigned char temp_lsb = this->readRegister(REG_TEMPERATURE_LSB);               // store the LSB
-    unsigned char decimal_bits = (temp_lsb & 0xC0) >> 6;                            // get the LSB
+    int16_t quarters;
+    if(this->getTemperatureQuarters(quarters)) return NAN;
+    return quarters / 4.0f;    // The minimum temperature measured is 0.25 degree Celsius
+}
 
-    // The minimum temperature measured is 0.25 degree Celsius
-    switch (decimal_bits)
+/**
+ * Reads all registers 0x00 through 0x12 in a single burst and decodes them, so that the time, the
+ * alarms, the control and status bits, the aging offset and the temperature are all consistent
+ * with each other. The shadow copy of the register file is refreshed on the way.
+ * 
+ * @param snap The `rtc_snapshot_t` to fill
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::snapshot(rtc_snapshot_t& snap)
+{
+    uint8_t* regs = snap.registers;
+    if(this->busRead(REG_TIME_SECONDS, regs, DS3231_NUM_REGISTERS))
     {
-    case 0b01:
-        temp_msb += 0.25;
-        break;
+        cerr << "RTC: Unable to read the register file" << endl;
+        return 1;
+    }
+    this->decodeTime(regs + REG_TIME_SECONDS, snap.time);
+    snap.century = field_time_century::get(regs);
+    this->decodeAlarm1(regs + REG_SECONDS_ALARM_1, snap.alarm_1);
+    this->decodeAlarm2(regs + REG_MINUTES_ALARM_2, snap.alarm_2);
+
+    snap.oscillator_enabled     = !field_control_oscillator_disabled::get(regs);
+    snap.battery_backed_sqw     = field_control_battery_backed_sqw::get(regs);
+    snap.convert_temperature    = field_control_convert_temperature::get(regs);
+    snap.sqw_rate               = field_control_sqw_rate::get(regs);
+    snap.interrupt_control      = field_control_interrupt_control::get(regs);
+    snap.alarm_2_int_enabled    = field_control_alarm_2_int_enabled::get(regs);
+    snap.alarm_1_int_enabled    = field_control_alarm_1_int_enabled::get(regs);
+
+    snap.oscillator_stopped     = field_status_oscillator_stopped::get(regs);
+    snap.enable_32kHz           = field_status_enable_32kHz::get(regs);
+    snap.busy                   = field_status_busy::get(regs);
+    snap.alarm_2_flag           = field_status_alarm_2_flag::get(regs);
+    snap.alarm_1_flag           = field_status_alarm_1_flag::get(regs);
+
+    snap.aging_offset           = field_aging_offset::get(regs);
+    snap.temperature            = this->decodeTemperature(regs + REG_TEMPERATURE_MSB) / 4.0f;
+
+    // the burst is also a fresh copy of the register file
+    for(int i = 0; i < DS3231_NUM_REGISTERS; i++) this->shadow[i] = regs[i];
+    this->shadow[REG_CONTROL] &= ~(MASK_CONV_TEMPERATURE);
+    this->shadowValid = true;
+    return 0;
+}
 
-    case 0b10:
-        temp_msb += 0.50;
-        break;
+/**
+ * Brings the module to the state of a configuration. The register file is read in one burst, the
+ * configuration is encoded over it and only the registers that differ are written, in as few
+ * auto-increment bursts as possible: runs of changed registers separated by at most
+ * APPLY_MERGE_GAP unchanged ones are sent as one burst, because resending a register costs less
+ * than the address and start/stop overhead of another transaction. The unchanged registers of a
+ * merged burst are written back as they were read, except the status flags, which are written as
+ * 1 unless they are to be cleared so a flag that is set meanwhile is not lost. The time registers
+ * are only written when set_time is given, as a whole, since writing them restarts the second, and
+ * the alarm registers only when set_alarm_1/set_alarm_2 are given. A changed aging offset starts
+ * a temperature conversion, as setAgingOffset() does, so it takes effect straight away.
+ * 
+ * @param config The state to bring the module to
+ * @param bursts Receives the number of write transactions that were needed
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::apply(const rtc_config_t& config, int& bursts)
+{
+    bursts = 0;
+    uint8_t current[DS3231_NUM_REGISTERS];
+    if(this->busRead(REG_TIME_SECONDS, current, DS3231_NUM_REGISTERS))
+    {
+        cerr << "RTC: Unable to read the register file" << endl;
+        return 1;
+    }
+    uint8_t target[DS3231_NUM_WRITABLE];
+    bool changed[DS3231_NUM_WRITABLE];
+    for(int i = 0; i < DS3231_NUM_WRITABLE; i++)
+    {
+        target[i]  = current[i];
+        changed[i] = false;
+    }
+
+    if(config.set_time)
+    {
+        rtc_epoch_to_registers(config.time, config.clock_12hr, target + REG_TIME_SECONDS);
+        for(int i = REG_TIME_SECONDS; i <= REG_TIME_YEAR; i++) changed[i] = true;
+    }
 
-    case 0b11:
-        temp_msb += 0.75;
-        break;
-    
-    default:
-        break;
+    // Alarms: time and rate, A1M1 through A1M4 and A2M2 through A2M4 from the bits of the rates
+    const user_alarm_t& a1 = config.alarm_1;
+    const user_alarm_t& a2 = config.alarm_2;
+    if(config.set_alarm_1)
+    {
+        if(this->encodeAlarm(1, a1.seconds, a1.minutes, a1.clock_12hr, a1.am_pm, a1.hours, a1.day_or_date, a1.day_date.day_of_week, target + REG_SECONDS_ALARM_1))
+            return 1;
+        field_alarm_1_mask_bits::set(target, a1.rate_alarm.rate_1);
     }
-    if(temp_reg_value & 0x80)
-        return -temp_msb;
-    else return temp_msb;
+    if(config.set_alarm_2)
+    {
+        if(this->encodeAlarm(2, 0, a2.minutes, a2.clock_12hr, a2.am_pm, a2.hours, a2.day_or_date, a2.day_date.day_of_week, target + REG_MINUTES_ALARM_2))
+            return 1;
+        field_alarm_2_mask_bits::set(target, a2.rate_alarm.rate_2);
+    }
+
+    // Control: CONV is never written, a conversion that is running finishes anyway
+    target[REG_CONTROL] = burst_control::encode(!config.oscillator_enabled, config.battery_backed_sqw, config.sqw_rate,
+                                                config.interrupt_control, config.alarm_2_int_enabled, config.alarm_1_int_enabled)[0];
+    current[REG_CONTROL] &= ~(MASK_CONV_TEMPERATURE);
+
+    // Status: the flags are write-0-to-clear, so the flags that stay are written as 1
+    uint8_t clearFlags = (config.clear_oscillator_stopped ? MASK_OSCILLATOR_STOP_FLAG : 0) |
+                         (config.clear_alarm_flags ? MASK_ALARM_2_FLAG | MASK_ALARM_1_FLAG : 0);
+    uint8_t flags = MASK_OSCILLATOR_STOP_FLAG | MASK_ALARM_2_FLAG | MASK_ALARM_1_FLAG;
+    target[REG_STATUS] = field_status_enable_32kHz::encode(config.enable_32kHz) | (flags & ~clearFlags);
+    changed[REG_STATUS] = ((current[REG_STATUS] ^ target[REG_STATUS]) & MASK_ENABLE_32KHZ_OUT) || (current[REG_STATUS] & clearFlags);
+
+    if(config.set_aging_offset) field_aging_offset::set(target, config.aging_offset);
+
+    for(int i = REG_SECONDS_ALARM_1; i < DS3231_NUM_WRITABLE; i++)
+        if(i != REG_STATUS && target[i] != current[i]) changed[i] = true;
+
+    // Send the changed runs, merging the ones that are close. Only the time registers cannot be
+    // resent unchanged, and they are either all changed or not in a burst at all.
+    int i = 0;
+    while(i < DS3231_NUM_WRITABLE)
+    {
+        if(!changed[i])
+        {
+            i++;
+            continue;
+        }
+        int first = i, last = i;
+        for(int j = i + 1; j < DS3231_NUM_WRITABLE && j - last <= APPLY_MERGE_GAP + 1; j++)
+            if(changed[j]) last = j;
+        if(this->busWrite(first, target + first, last - first + 1))
+        {
+            this->shadowValid = false;  // the chip may hold part of the configuration
+            cerr << "RTC: Unable to apply the configuration" << endl;
+            return 1;
+        }
+        bursts++;
+        i = last + 1;
+    }
+
+    // the read and the writes make up a fresh copy of the register file
+    for(int r = 0; r < DS3231_NUM_REGISTERS; r++) this->shadow[r] = r < DS3231_NUM_WRITABLE ? target[r] : current[r];
+    this->shadow[REG_STATUS] = (current[REG_STATUS] & ~clearFlags & ~MASK_ENABLE_32KHZ_OUT) | (target[REG_STATUS] & MASK_ENABLE_32KHZ_OUT);
+    this->shadowValid = true;
+
+    // the TCXO only applies a new aging offset at its next conversion, which may be 64 seconds away
+    if(changed[REG_AGING_OFFSET]) return this->startTemperatureConversion();
+    return 0;
 }
 
 /**
- * Sets the time alarm based on specified parameters. It is used by setTimeAlarm1 and setTimeAlarm2 functions
+ * Brings the module to the state of a configuration, see apply(const rtc_config_t&, int&).
  * 
- * @param alarm_num Specifies which alarm to set, either alarm 1 or alarm 2.
+ * @param config The state to bring the module to
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::apply(const rtc_config_t& config)
+{
+    int bursts;
+    return this->apply(config, bursts);
+}
+
+/**
+ * Validates and encodes an alarm time into its registers, with the mask bits clear. It is used by setTimeAlarm and apply.
+ * 
+ * @param alarm_num Specifies which alarm to encode, either alarm 1 or alarm 2.
+ * @param seconds Represents the seconds value for setting the alarm, ignored for alarm 2. It should be an integer value between 0 and 59.
  * @param minutes Represents the minutes value for setting the alarm. It should be an integer value between 0 and 59.
  * @param clock_12_hr Specify whether the clock is in 12-hour format or not.
  * @param am_pm Specify whether the alarm time is in the AM or PM for a 12-hour clock format. It is of type `AM_OR_PM`, which
@@ -231,21 +764,29 @@ float RTC::getTemperature()
  * @param hours Represents the hour at which the alarm should trigger.
  * @param day_or_date Specify whether the alarm should be set based on a day of the week or a specific date in the month.
  * @param day_date Represents either the day of the week or the date of the month, depending on the value of the `day_or_date` parameter.
+ * @param regs Receives 0x07 through 0x0A for Alarm 1, 0x0B through 0x0D for Alarm 2
  * 
- * @return 0 if successful, 1 if unsuccessful
+ * @return 0 if successful, 1 if the alarm time is not valid
  */
-int RTC::setTimeAlarm(uint8_t alarm_num, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date)
+int RTC::encodeAlarm(uint8_t alarm_num, uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date, uint8_t* regs)
 {
+    // Set alarm seconds
+    if(seconds > 59)
+    {
+        cerr << "Seconds cannot be greater than 59 or less than 0" << endl;
+        return 1;
+    }
     // Set alarm minutes
-    if(minutes > 59 || minutes < 0)
+    if(minutes > 59)
     {
         cerr << "Minutes can't be more than 59 or less than 0" << endl;
         return 1;
     }
-    unsigned char minutesBCD = decimal_to_BCD(minutes);
+    // Alarm 2 has the layout of 0x08 through 0x0A, so the Alarm 1 fields encode both
+    unsigned char minutesBCD = field_alarm_1_minutes::encode(minutes);
 
     // Set alarm hours
-    if(hours > 23 || hours < 0)
+    if(hours > 23)
     {
         cerr << "Hours cannot be more than 23 or less than 0" << endl;
         return 1;
@@ -253,28 +794,23 @@ int RTC::setTimeAlarm(uint8_t alarm_num, uint8_t minutes, CLOCK_FORMAT clock_12_
     unsigned char hoursBCD;
     if(clock_12_hr)
     {
-        hoursBCD = this->decimal_to_BCD(hours) | 0x40;
-        if(am_pm) hoursBCD |= 0x20;
+        hoursBCD = field_alarm_1_clock_12hr::encode(FORMAT_0_12) | field_alarm_1_am_pm::encode(am_pm) |
+                   field_alarm_1_hours_12::encode(hours);
     } else {
-        hoursBCD = this->decimal_to_BCD(hours);
+        hoursBCD = field_alarm_1_hours_24::encode(hours);
     }
 
-    // Set Alarm day or date
-    unsigned char day_date_to_set = 0;
-    // If mode is Day of the week, then set bit 6 of the 0x0A register
+    // Set Alarm day or date, DY/DT (bit 6 of the 0x0A register) is set for the day of the week
     if(day_or_date == DAY_OF_WEEK)
     {
-        day_date_to_set |= MASK_ALARM_DAY_OR_DATEINV;
         if(day_date > 7 || day_date < 1)
         {
             cerr << "Day cannot be greater than 7 or lesser than 1" << endl;
             return 1;
         }
     }
-    // If mode is date of the month, then clear the bit 6 of the 0x0A register
     else if (day_or_date == DATE_OF_MONTH)
     {
-        day_date_to_set &= ~(MASK_ALARM_DAY_OR_DATEINV);
         if(day_date > 31 || day_date < 1)
         {
             cerr << "Date cannot be greater than 31 or lesser than 1" << endl;
@@ -286,30 +822,39 @@ int RTC::setTimeAlarm(uint8_t alarm_num, uint8_t minutes, CLOCK_FORMAT clock_12_
         cerr << "If Day then DAY_OF_WEEK, if Date then DATE_OF_MONTH, no other values permitted" << endl;
         return 1;
     }
-    day_date_to_set |= decimal_to_BCD(day_date) & 0x3F; // set the day or date value
-    unsigned char day_date_to_set_BCD = static_cast<unsigned char>(day_date_to_set);
+    unsigned char day_date_to_set = field_alarm_1_day_or_date::encode(day_or_date) | field_alarm_1_day_date::encode(day_date);
+
+    // Alarm 1 is 0x07, 0x08, 0x09, 0x0A, Alarm 2 has no seconds register: 0x0B, 0x0C, 0x0D
+    int i = 0;
+    if(alarm_num == 1) regs[i++] = field_alarm_1_seconds::encode(seconds);
+    regs[i++] = minutesBCD;
+    regs[i++] = hoursBCD;
+    regs[i]   = day_date_to_set;
+    return 0;
+}
 
+/**
+ * Sets the time alarm based on specified parameters. It is used by setTimeAlarm1 and setTimeAlarm2 functions.
+ * The alarm registers are written in a single burst, 0x07 through 0x0A for Alarm 1 and 0x0B through 0x0D for Alarm 2.
+ * 
+ * @param alarm_num Specifies which alarm to set, either alarm 1 or alarm 2.
+ * @param seconds Represents the seconds value for setting the alarm, ignored for alarm 2. It should be an integer value between 0 and 59.
+ * @param minutes Represents the minutes value for setting the alarm. It should be an integer value between 0 and 59.
+ * @param clock_12_hr Specify whether the clock is in 12-hour format or not.
+ * @param am_pm Specify whether the alarm time is in the AM or PM for a 12-hour clock format.
+ * @param hours Represents the hour at which the alarm should trigger.
+ * @param day_or_date Specify whether the alarm should be set based on a day of the week or a specific date in the month.
+ * @param day_date Represents either the day of the week or the date of the month, depending on the value of the `day_or_date` parameter.
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::setTimeAlarm(uint8_t alarm_num, uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date)
+{
+    uint8_t regs[4];
+    if(this->encodeAlarm(alarm_num, seconds, minutes, clock_12_hr, am_pm, hours, day_or_date, day_date, regs)) return 1;
     int res = 0;
-    // if alarm_num==1, the write to the registers of Alarm 1: 0x08, 0x09, 0x0A
-    if(alarm_num == 1)
-    {
-        res = this->writeRegister(REG_MINUTES_ALARM_1, minutesBCD);
-        if(res) return res;
-        res = this->writeRegister(REG_HOURS_ALARM_1, hoursBCD);
-        if(res) return res;
-        res = this->writeRegister(REG_DAYS_ALARM_1, day_date_to_set_BCD);
-        if(res) return res;
-    } 
-    // if alarm_num==2, the write to the registers of Alarm 1: 0x0B, 0x0C, 0x0D
-    else if (alarm_num == 2)
-    {
-        res = this->writeRegister(REG_MINUTES_ALARM_2, minutesBCD);
-        if(res) return res;
-        res = this->writeRegister(REG_HOURS_ALARM_2, hoursBCD);
-        if(res) return res;
-        res = this->writeRegister(REG_DAYS_ALARM_2, day_date_to_set_BCD);
-        if(res) return res;
-    }
+    if(alarm_num == 1) res = this->writeShadow(REG_SECONDS_ALARM_1, regs, 4);
+    else if(alarm_num == 2) res = this->writeShadow(REG_MINUTES_ALARM_2, regs, 3);
     if(res) cerr << "RTC: Unable to set the Alarm" << endl;
     return res;
 }
@@ -330,21 +875,12 @@ int RTC::setTimeAlarm(uint8_t alarm_num, uint8_t minutes, CLOCK_FORMAT clock_12_
  */
 int RTC::setTimeAlarm1(uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date)
 {
-    if(seconds > 59 || seconds < 0)
-    {
-        cerr << "Seconds cannot be greater than 59 or less than 0" << endl;
-        return 1;
-    }
     int res = 0;
-    // set the alarm without the minutes first, using the private function
-    res = this->setTimeAlarm(1, minutes, clock_12_hr, am_pm, hours, day_or_date, day_date);
-    if(res) return res;
-    // write the seconds value to 0x07
-    res = this->writeRegister(REG_SECONDS_ALARM_1, decimal_to_BCD(seconds));
+    // set the alarm registers 0x07 through 0x0A using the private function
+    res = this->setTimeAlarm(1, seconds, minutes, clock_12_hr, am_pm, hours, day_or_date, day_date);
     if(res) return res;
-    // read the contents of the control register, set the INTCN and A1IE bits and write back to RTC
-    uint8_t readControlRegister = this->readRegister(REG_CONTROL);
-    res = this->writeRegister(REG_CONTROL, (readControlRegister | MASK_ALARM_1_INT_ENABLE | MASK_INTERRUPT_CONTROL));
+    // set the INTCN and A1IE bits of the control register
+    res = this->modifyRegister(REG_CONTROL, 0, MASK_ALARM_1_INT_ENABLE | MASK_INTERRUPT_CONTROL);
     if(res) return res;
     return res;
 }
@@ -365,11 +901,10 @@ int RTC::setTimeAlarm2(uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm
 {
     int res = 0;
     // Set the alarm using the private function
-    res = this->setTimeAlarm(2, minutes, clock_12_hr, am_pm, hours, day_or_date, day_date);
+    res = this->setTimeAlarm(2, 0, minutes, clock_12_hr, am_pm, hours, day_or_date, day_date);
     if(res) return res;
-    // read the contents of the control register, set the INTCN and A12E bits and write back to RTC
-    uint8_t readControlRegister = this->readRegister(REG_CONTROL);
-    res = this->writeRegister(REG_CONTROL, (readControlRegister | MASK_ALARM_2_INT_ENABLE | MASK_INTERRUPT_CONTROL));
+    // set the INTCN and A2IE bits of the control register
+    res = this->modifyRegister(REG_CONTROL, 0, MASK_ALARM_2_INT_ENABLE | MASK_INTERRUPT_CONTROL);
     if(res) return res;
     return res;
 }
@@ -386,17 +921,12 @@ int RTC::setTimeAlarm2(uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm
  * - ALARM_1_ONCE_PER_MINUTE
  * - ALARM_1_ONCE_PER_SECOND
  */
-rate_alarm_1 RTC::getRateAlarm1(uint8_t* alarm_1_regs)  // Get the alarm registers from the calling function
+rate_alarm_1 RTC::getRateAlarm1(const uint8_t* alarm_1_regs)  // Get the alarm registers from the calling function
 {
-    uint8_t A1M4 = alarm_1_regs[3] >> 7;            // Extract A1M4
-    if(A1M4 == 0) return ALARM_1_ONCE_PER_DATE_DAY; // if A1M4 is zero, then alarm rings once every date or day
-    uint8_t A1M3 = alarm_1_regs[2] >> 7;            // Extract A1M3 
-    if(A1M3 == 0) return ALARM_1_ONCE_PER_DAY;      // if A1M3 is zero, then alarm rings when the hours, minutes and seconds match
-    uint8_t A1M2 = alarm_1_regs[1] >> 7;            // Extract A1M2
-    if(A1M2 == 0) return ALARM_1_ONCE_PER_HOUR;     // if A1M2 is zero, then alarm rings when the seconds and minutes match
-    uint8_t A1M1 = alarm_1_regs[0] >> 7;            // Extract A1M4
-    if(A1M1 == 0) return ALARM_1_ONCE_PER_MINUTE;   // if A1M1 is zero, then alarm rings when the seconds match
-    return ALARM_1_ONCE_PER_SECOND;                 // if all 4 bits are set, the alarm rings every minute
+    // A1M1 through A1M4 as bits 0 through 3, the bits of the rate enum
+    uint8_t bits = field_alarm_1_mask_bits::get(alarm_1_regs, REG_SECONDS_ALARM_1);
+    // the first clear bit from A1M4 down decides the rate, e.g. A1M3 clear is ALARM_1_ONCE_PER_DAY
+    return static_cast<rate_alarm_1>(rtc_leading_ones(bits, 4));
 }
 
 /**
@@ -410,94 +940,136 @@ rate_alarm_1 RTC::getRateAlarm1(uint8_t* alarm_1_regs)  // Get the alarm registe
  * - ALARM_2_ONCE_PER_HOUR
  * - ALARM_2_ONCE_PER_MINUTE
  */
-rate_alarm_2 RTC::getRateAlarm2(uint8_t* alarm_2_regs)
+rate_alarm_2 RTC::getRateAlarm2(const uint8_t* alarm_2_regs)
 {
-    uint8_t A2M4 = alarm_2_regs[2] >> 7;            // Extract A2M4
-    if(A2M4 == 0) return ALARM_2_ONCE_PER_DATE_DAY; // if A2M4 is zero, then alarm rings once every date or day
-    uint8_t A2M3 = alarm_2_regs[1] >> 7;            // Extract A2M3
-    if(A2M3 == 0) return ALARM_2_ONCE_PER_DAY;      // if A2M3 is zero, then alarm rings when hours and minutes match
-    uint8_t A2M2 = alarm_2_regs[0] >> 7;            // Extract A2M2
-    if(A2M2 == 0) return ALARM_2_ONCE_PER_HOUR;     // if A2M2 is zero, then alarm rings when minutes match
-    return ALARM_2_ONCE_PER_MINUTE;                 // if all 3 bits are set, then the alarm rings every minute
+    // A2M2 through A2M4 as bits 0 through 2, the bits of the rate enum
+    uint8_t bits = field_alarm_2_mask_bits::get(alarm_2_regs, REG_MINUTES_ALARM_2);
+    // the first clear bit from A2M4 down decides the rate, e.g. A2M3 clear is ALARM_2_ONCE_PER_DAY
+    return static_cast<rate_alarm_2>(rtc_leading_ones(bits, 3));
 }
 
 /**
- * Returns a pointer to a struct containing information about alarm 1.
+ * Decodes the Alarm 1 registers 0x07 through 0x0A into a `user_alarm_t`, every field is written.
  * 
- * @return a memory safe shared pointer `user_alarm_ptr_t` to a `user_alarm_t` struct
+ * @param alarm_1_regs The four Alarm 1 registers, starting with the seconds
+ * @param alarm_1 The `user_alarm_t` to fill
  */
-user_alarm_ptr_t RTC::getAlarm1()
+void RTC::decodeAlarm1(const uint8_t* alarm_1_regs, user_alarm_t& alarm_1)
 {
-    // get the memory safe pointer to new alarm object to store the information
-    user_alarm_ptr_t alarm_1 (new user_alarm_t);
-    // get the register values in a single read (0x07 through 0x0A)
-    uint8_t* alarm_1_regs = this->readRegisters(4, REG_SECONDS_ALARM_1);
-    // get the rate of the alarm by giving the function the registers we got in the previous line
-    rate_alarm_1 alarm_rate = this->getRateAlarm1(alarm_1_regs);
-    alarm_1->rate_alarm.rate_1 = alarm_rate; // Set the rate of the alarm
-    alarm_1->alarm_num = 1;                  // Set the alarm number to 1
+    // get the rate of the alarm from the A1Mx bits of the registers
+    alarm_1.rate_alarm.rate_1 = this->getRateAlarm1(alarm_1_regs);
+    alarm_1.alarm_num = 1;                  // Set the alarm number to 1
     // Set the timing of the alarm by extracting the values from the appropriate registers
-    alarm_1->seconds = this->BCD_to_decimal(alarm_1_regs[0] & MASK_ALARM_SECONDS);
-    alarm_1->minutes = this->BCD_to_decimal(alarm_1_regs[1] & MASK_ALARM_MINUTES);
+    const uint8_t first = REG_SECONDS_ALARM_1;
+    alarm_1.seconds = field_alarm_1_seconds::get(alarm_1_regs, first);
+    alarm_1.minutes = field_alarm_1_minutes::get(alarm_1_regs, first);
 
     // Check if the 12 hour clock bit (bit 6) is set in 0x09
-    if(alarm_1_regs[2] & 0x40) alarm_1->clock_12hr = FORMAT_0_12;
+    alarm_1.clock_12hr = field_alarm_1_clock_12hr::get(alarm_1_regs, first);
+    alarm_1.am_pm = AM;
     // if the 12 hour clock bit is set
-    if(alarm_1->clock_12hr)
+    if(alarm_1.clock_12hr)
     {
         // if the PM bit (bit 5) is set in 0x09, set to PM
-        if((alarm_1_regs[2] & 0x20) >> 5) alarm_1->am_pm = PM;
-        // if the AM bit (bit 5) is clear in 0x09, set to AM
-        else alarm_1->am_pm = AM;
-        alarm_1->hours   = this->BCD_to_decimal(alarm_1_regs[2] & 0x1F); // set the hours
-    }
-    // if it is a 24 hour clock, write the hours straight to the register
-    else alarm_1->hours = this->BCD_to_decimal(alarm_1_regs[2] & 0x3F);
-    
+        alarm_1.am_pm = field_alarm_1_am_pm::get(alarm_1_regs, first);
+        alarm_1.hours = field_alarm_1_hours_12::get(alarm_1_regs, first);   // set the hours
+    }
+    // if it is a 24 hour clock, the hours take bits 0 through 5
+    else alarm_1.hours = field_alarm_1_hours_24::get(alarm_1_regs, first);
+
     // Set the Day of week if bit 6 is set, else set date of month from regsiter 0x0A
-    alarm_1->day_or_date = ((alarm_1_regs[3] & MASK_ALARM_DAY_OR_DATEINV) >> 6) ? DAY_OF_WEEK : DATE_OF_MONTH;
-    if(alarm_1->day_or_date) alarm_1->day_date.day_of_week = BCD_to_decimal(alarm_1_regs[3] & MASK_ALARM_DAY_DATE);
-    else alarm_1->day_date.date_of_month = BCD_to_decimal(alarm_1_regs[3] & MASK_ALARM_DAY_DATE);
+    alarm_1.day_or_date = field_alarm_1_day_or_date::get(alarm_1_regs, first);
+    if(alarm_1.day_or_date) alarm_1.day_date.day_of_week = field_alarm_1_day_date::get(alarm_1_regs, first);
+    else alarm_1.day_date.date_of_month = field_alarm_1_day_date::get(alarm_1_regs, first);
+}
 
-    return alarm_1;
+/**
+ * Stores the details of Alarm 1 in a `user_alarm_t` owned by the caller. It performs no heap allocation.
+ * 
+ * @param alarm_1 The `user_alarm_t` to fill, every field is written
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getAlarm1(user_alarm_t& alarm_1)
+{
+    // get the register values (0x07 through 0x0A) from the shadow copy
+    if(this->loadShadow()) return 1;
+    this->decodeAlarm1(this->shadow + REG_SECONDS_ALARM_1, alarm_1);
+    return 0;
 }
 
 /**
- * Returns a pointer to a struct containing information about alarm 2.
+ * Returns a pointer to a struct containing information about alarm 1.
  * 
- * @return a memory safe shared pointer `user_alarm_ptr_t` to a `user_alarm_t` struct
+ * @return a memory safe shared pointer `user_alarm_ptr_t` to a `user_alarm_t` struct, nullptr if the read failed
  */
-user_alarm_ptr_t RTC::getAlarm2()
+user_alarm_ptr_t RTC::getAlarm1()
 {
-    // get the memory safe pointer to new alarm object to store the information
-    user_alarm_ptr_t alarm_2 (new user_alarm_t);
-    // get the register values in a single read (0x0B through 0x0D)
-    uint8_t* alarm_2_regs = this->readRegisters(3, REG_MINUTES_ALARM_2);
-    // get the rate of the alarm by giving the function the registers we got in the previous line
-    rate_alarm_2 alarm_rate = this->getRateAlarm2(alarm_2_regs);
-    alarm_2->rate_alarm.rate_2 = alarm_rate;    // Set the rate of the alarm
-    alarm_2->alarm_num = 2;                     // Set the alarm number to 2
+    user_alarm_t alarm_1;
+    if(this->getAlarm1(alarm_1)) return nullptr;
+    return std::make_shared<user_alarm_t>(alarm_1);
+}
+
+/**
+ * Decodes the Alarm 2 registers 0x0B through 0x0D into a `user_alarm_t`, every field is written.
+ * Alarm 2 has no seconds register, so the seconds are always 0.
+ * 
+ * @param alarm_2_regs The three Alarm 2 registers, starting with the minutes
+ * @param alarm_2 The `user_alarm_t` to fill
+ */
+void RTC::decodeAlarm2(const uint8_t* alarm_2_regs, user_alarm_t& alarm_2)
+{
+    // get the rate of the alarm from the A2Mx bits of the registers
+    alarm_2.rate_alarm.rate_2 = this->getRateAlarm2(alarm_2_regs);
+    alarm_2.alarm_num = 2;                     // Set the alarm number to 2
     // Set the timing of the alarm by extracting the values from the appropriate registers
-    alarm_2->minutes = this->BCD_to_decimal(alarm_2_regs[0] & MASK_ALARM_MINUTES);
+    alarm_2.seconds = 0;
+    const uint8_t first = REG_MINUTES_ALARM_2;
+    alarm_2.minutes = field_alarm_2_minutes::get(alarm_2_regs, first);
 
     // Check if the 12 hour clock bit (bit 6) is set in 0x0C
-    if(alarm_2->clock_12hr)
+    alarm_2.clock_12hr = field_alarm_2_clock_12hr::get(alarm_2_regs, first);
+    alarm_2.am_pm = AM;
+    if(alarm_2.clock_12hr)
     {
         // if the PM bit (bit 5) is set in 0x0C, set to PM
-        if((alarm_2_regs[1] & 0x20) >> 5) alarm_2->am_pm = PM;
-        // if the AM bit (bit 5) is clear in 0x0C, set to AM
-        else alarm_2->am_pm = AM;
-        alarm_2->hours   = this->BCD_to_decimal(alarm_2_regs[1] & 0x1F); // set the hours
-    }
-    // if it is a 24 hour clock, write the hours straight to the register
-    else alarm_2->hours = this->BCD_to_decimal(alarm_2_regs[1] & 0x3F);
-    
+        alarm_2.am_pm = field_alarm_2_am_pm::get(alarm_2_regs, first);
+        alarm_2.hours = field_alarm_2_hours_12::get(alarm_2_regs, first);   // set the hours
+    }
+    // if it is a 24 hour clock, the hours take bits 0 through 5
+    else alarm_2.hours = field_alarm_2_hours_24::get(alarm_2_regs, first);
+
     // Set the Day of week if bit 6 is set, else set date of month from regsiter 0x0D
-    alarm_2->day_or_date = ((alarm_2_regs[2] & MASK_ALARM_DAY_OR_DATEINV) >> 6) ? DAY_OF_WEEK : DATE_OF_MONTH;
-    if(alarm_2->day_or_date) alarm_2->day_date.day_of_week = BCD_to_decimal(alarm_2_regs[2] & MASK_ALARM_DAY_DATE);
-    else alarm_2->day_date.date_of_month = BCD_to_decimal(alarm_2_regs[2] & MASK_ALARM_DAY_DATE);
+    alarm_2.day_or_date = field_alarm_2_day_or_date::get(alarm_2_regs, first);
+    if(alarm_2.day_or_date) alarm_2.day_date.day_of_week = field_alarm_2_day_date::get(alarm_2_regs, first);
+    else alarm_2.day_date.date_of_month = field_alarm_2_day_date::get(alarm_2_regs, first);
+}
 
-    return alarm_2;
+/**
+ * Stores the details of Alarm 2 in a `user_alarm_t` owned by the caller. It performs no heap allocation.
+ * 
+ * @param alarm_2 The `user_alarm_t` to fill, every field is written
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getAlarm2(user_alarm_t& alarm_2)
+{
+    // get the register values (0x0B through 0x0D) from the shadow copy
+    if(this->loadShadow()) return 1;
+    this->decodeAlarm2(this->shadow + REG_MINUTES_ALARM_2, alarm_2);
+    return 0;
+}
+
+/**
+ * Returns a pointer to a struct containing information about alarm 2.
+ * 
+ * @return a memory safe shared pointer `user_alarm_ptr_t` to a `user_alarm_t` struct, nullptr if the read failed
+ */
+user_alarm_ptr_t RTC::getAlarm2()
+{
+    user_alarm_t alarm_2;
+    if(this->getAlarm2(alarm_2)) return nullptr;
+    return std::make_shared<user_alarm_t>(alarm_2);
 }
 
 /**
@@ -510,46 +1082,18 @@ user_alarm_ptr_t RTC::getAlarm2()
  */
 int RTC::setRateAlarm1(rate_alarm_1 rate)   // get the rate of alarm 1 from the enum
 {
-    int res = 0;
-    // extract the data from the registers in a single read
-    uint8_t* alarm_regs = this->readRegisters(4, REG_SECONDS_ALARM_1);
-    uint8_t A1M1, A1M2, A1M3, A1M4;
-
-    // Set A1M1
-    A1M1 = rate & 0b1;
-    if(A1M1) alarm_regs[0] |= 0x80;
-    else alarm_regs[0] &= ~(0x80);
-    // Write back to 0x07
-    res = this->writeRegister(REG_SECONDS_ALARM_1,alarm_regs[0]);
-    if(res) return 1;
-
-    // Set A1M2
-    A1M2 = rate & 0b10;
-    if(A1M2) alarm_regs[1] |= 0x80;
-    else alarm_regs[1] &= ~(0x80);
-    // Write back to 0x08
-    res = this->writeRegister(REG_MINUTES_ALARM_1,alarm_regs[1]);
-    if(res) return 1;
-
-    // Set A1M3
-    A1M3 = rate & 0b100;
-    if(A1M3) alarm_regs[2] |= 0x80;
-    else alarm_regs[2] &= ~(0x80);
-    // Write back to 0x09
-    res = this->writeRegister(REG_HOURS_ALARM_1,alarm_regs[2]);
-    if(res) return 1;
-
-    // Set A1M4
-    A1M4 = rate & 0b1000;
-    if(A1M4) alarm_regs[3] |= 0x80;
-    else alarm_regs[3] &= ~(0x80);
-    // Write back to 0x0A
-    res = this->writeRegister(REG_DAYS_ALARM_1,alarm_regs[3]);
-    if(res) return 1;
+    // copy the alarm registers from the shadow copy
+    if(this->loadShadow()) return 1;
+    uint8_t alarm_regs[4];
+    for(int i = 0; i < 4; i++) alarm_regs[i] = this->shadow[REG_SECONDS_ALARM_1 + i];
+
+    // Set A1M1 through A1M4 (bit 7 of 0x07 through 0x0A) from bits 0 through 3 of the rate
+    field_alarm_1_mask_bits::set(alarm_regs, rate, REG_SECONDS_ALARM_1);
+    // Write back the changed part of 0x07 through 0x0A in a single burst
+    if(this->writeShadow(REG_SECONDS_ALARM_1, alarm_regs, 4)) return 1;
     return 0;
 }
 
-/**
 /**
  * Sets the rate of the alarm 2. 
  * 
@@ -560,63 +1104,129 @@ int RTC::setRateAlarm1(rate_alarm_1 rate)   // get the rate of alarm 1 from the
  */
 int RTC::setRateAlarm2(rate_alarm_2 rate)
 {
-    int res = 0;
-    // extract the data from the registers in a single read
-    uint8_t* alarm_regs = this->readRegisters(3, REG_MINUTES_ALARM_2);
-    uint8_t A2M2, A2M3, A2M4;
-
-    // Set A2M2
-    A2M2 = rate & 0b1;
-    if(A2M2) alarm_regs[0] |= 0x80;
-    else alarm_regs[0] &= ~(0x80);
-    // Write back to 0x0B
-    res = this->writeRegister(REG_MINUTES_ALARM_2,alarm_regs[0]);
-    if(res) return 1;
-
-    // Set A2M3
-    A2M3 = rate & 0b10;
-    if(A2M3) alarm_regs[1] |= 0x80;
-    else alarm_regs[1] &= ~(0x80);
-    // Write back to 0x0C
-    res = this->writeRegister(REG_HOURS_ALARM_2,alarm_regs[1]);
-    if(res) return 1;
-
-    // Set A2M4
-    A2M4 = rate & 0b100;
-    if(A2M4) alarm_regs[2] |= 0x80;
-    else alarm_regs[2] &= ~(0x80);
-    // Write back to 0x0D
-    res = this->writeRegister(REG_DAYS_ALARM_2,alarm_regs[2]);
-    if(res) return 1;
+    // copy the alarm registers from the shadow copy
+    if(this->loadShadow()) return 1;
+    uint8_t alarm_regs[3];
+    for(int i = 0; i < 3; i++) alarm_regs[i] = this->shadow[REG_MINUTES_ALARM_2 + i];
+
+    // Set A2M2 through A2M4 (bit 7 of 0x0B through 0x0D) from bits 0 through 2 of the rate
+    field_alarm_2_mask_bits::set(alarm_regs, rate, REG_MINUTES_ALARM_2);
+    // Write back the changed part of 0x0B through 0x0D in a single burst
+    if(this->writeShadow(REG_MINUTES_ALARM_2, alarm_regs, 3)) return 1;
+    return 0;
+}
+
+/**
+ * Programs both alarms from seconds since the epoch and enables their interrupts, in a single
+ * burst over 0x07 through 0x0E. Alarm 1 matches the date, hours, minutes and seconds of alarm1At,
+ * Alarm 2 the date, hours and minutes of alarm2At. Registers that already hold the value are not
+ * written.
+ * 
+ * @param alarm1At The time Alarm 1 fires at
+ * @param alarm2At The time Alarm 2 fires at, its seconds are ignored
+ * @param clock_12_hr The format of the hours registers, the one the time is kept in
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::setAlarmsAt(time_t alarm1At, time_t alarm2At, CLOCK_FORMAT clock_12_hr)
+{
+    if(this->loadShadow()) return 1;
+    uint8_t t1[7], t2[7];
+    rtc_epoch_to_registers(alarm1At, clock_12_hr, t1);
+    rtc_epoch_to_registers(alarm2At, clock_12_hr, t2);
+
+    // the alarm registers share the BCD layout of the time registers, with every mask bit and DY/DT clear
+    uint8_t regs[8];
+    regs[0] = t1[REG_TIME_SECONDS];
+    regs[1] = t1[REG_TIME_MINUTES];
+    regs[2] = t1[REG_TIME_HOURS];
+    regs[3] = t1[REG_TIME_DATE_OF_MONTH];
+    regs[4] = t2[REG_TIME_MINUTES];
+    regs[5] = t2[REG_TIME_HOURS];
+    regs[6] = t2[REG_TIME_DATE_OF_MONTH];
+    regs[7] = this->shadow[REG_CONTROL] | MASK_INTERRUPT_CONTROL | MASK_ALARM_2_INT_ENABLE | MASK_ALARM_1_INT_ENABLE;
+    if(this->writeShadow(REG_SECONDS_ALARM_1, regs, 8))
+    {
+        cerr << "RTC: Unable to set the alarms" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Writes the Alarm 1 registers 0x07 through 0x0A as they are, mask bits included, in a single
+ * burst and enables the interrupt of Alarm 1. Registers that already hold the value are not written.
+ * 
+ * @param regs The four registers, e.g. compiled by cron_compile()
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::setAlarm1Registers(const uint8_t* regs)
+{
+    if(this->writeShadow(REG_SECONDS_ALARM_1, regs, 4) ||
+       this->modifyRegister(REG_CONTROL, 0, MASK_ALARM_1_INT_ENABLE | MASK_INTERRUPT_CONTROL))
+    {
+        cerr << "RTC: Unable to set Alarm 1" << endl;
+        return 1;
+    }
+    return 0;
+}
 
+/**
+ * Reads which alarms have fired, the A1F and A2F flags of the status register, in a single transaction.
+ * 
+ * @param flags Receives MASK_ALARM_1_FLAG and/or MASK_ALARM_2_FLAG for the alarms that fired
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getAlarmFlags(uint8_t& flags)
+{
+    unsigned char status;
+    if(this->busRead(REG_STATUS, &status, 1))
+    {
+        cerr << "RTC: Unable to read the alarm flags" << endl;
+        return 1;
+    }
+    flags = status & (MASK_ALARM_1_FLAG | MASK_ALARM_2_FLAG);
     return 0;
 }
 
 /**
- * Snoozes Alarm 1 by clearing the A1F flag in the status register.
+ * Clears the given alarm flags in a single write, leaving the other flags as they are, so an alarm
+ * that fires in between is not lost.
+ * 
+ * @param flags MASK_ALARM_1_FLAG and/or MASK_ALARM_2_FLAG
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::clearAlarmFlags(uint8_t flags)
+{
+    int res = this->writeStatus(flags & (MASK_ALARM_1_FLAG | MASK_ALARM_2_FLAG));
+    if(res) cerr << "RTC: Unable to clear the alarm flags" << endl;
+    return res;
+}
+
+/**
+ * Snoozes Alarm 1 by clearing the A1F flag in the status register, in a single write.
  * 
  * @return 0 if successful, 1 if unsuccessful
  */
 int RTC::snoozeAlarm1()
 {
-    uint8_t status_reg = this->readRegister(REG_STATUS);    // Read the status register 0x0F
-    status_reg &= ~(MASK_ALARM_1_FLAG);                     // Clear the A1F bit
-    int res = this->writeRegister(REG_STATUS, status_reg);  // Write the modified value back to 0x0F
+    int res = this->writeStatus(MASK_ALARM_1_FLAG);         // Clear the A1F bit of 0x0F
     if(res) cerr << "RTC: Unable to snooze Alarm 1" << endl;
     return res;
 }
 
 /**
- * Snoozes Alarm 2 by clearing the A2F flag in the status register.
+ * Snoozes Alarm 2 by clearing the A2F flag in the status register, in a single write.
  * 
  * @return 0 if successful, 1 if unsuccessful
  */
 int RTC::snoozeAlarm2()
 {
-    uint8_t status_reg = this->readRegister(REG_STATUS);    // Read the status register 0x0F
-    status_reg &= ~(MASK_ALARM_2_FLAG);                     // Clear the A2F bit
-    int res = this->writeRegister(REG_STATUS, status_reg);  // Write the modified value back to 0x0F
-    if(res) cerr << "RTC: Unable to snooze Alarm 1" << endl;
+    int res = this->writeStatus(MASK_ALARM_2_FLAG);         // Clear the A2F bit of 0x0F
+    if(res) cerr << "RTC: Unable to snooze Alarm 2" << endl;
     return res;
 }
 
@@ -627,9 +1237,7 @@ int RTC::snoozeAlarm2()
  */
 int RTC::enableInterruptAlarm1()
 {
-    uint8_t control_reg = this->readRegister(REG_CONTROL);  // Read the Control register 0x0E
-    control_reg |= (MASK_ALARM_1_INT_ENABLE);               // Set the A1IE bit
-    int res = this->writeRegister(REG_CONTROL, control_reg);// Write the modified value back to 0x0E
+    int res = this->modifyRegister(REG_CONTROL, 0, MASK_ALARM_1_INT_ENABLE);   // Set the A1IE bit of 0x0E
     if(res) cerr << "RTC: Unable to enable Alarm 1" << endl;
     return res;
 }
@@ -641,9 +1249,7 @@ int RTC::enableInterruptAlarm1()
  */
 int RTC::disableInterruptAlarm1()
 {
-    uint8_t control_reg = this->readRegister(REG_CONTROL);  // Read the Control register 0x0E
-    control_reg &= ~(MASK_ALARM_1_INT_ENABLE);              // Clear the A1IE bit
-    int res = this->writeRegister(REG_CONTROL, control_reg);// Write the modified value back to 0x0E
+    int res = this->modifyRegister(REG_CONTROL, MASK_ALARM_1_INT_ENABLE, 0);   // Clear the A1IE bit of 0x0E
     if(res) cerr << "RTC: Unable to disable Alarm 1" << endl;
     return res;
 }
@@ -655,9 +1261,7 @@ int RTC::disableInterruptAlarm1()
  */
 int RTC::enableInterruptAlarm2()
 {
-    uint8_t control_reg = this->readRegister(REG_CONTROL);  // Read the Control register 0x0E
-    control_reg |= (MASK_ALARM_2_INT_ENABLE);               // Set the A2IE bit
-    int res = this->writeRegister(REG_CONTROL, control_reg);// Write the modified value back to 0x0E
+    int res = this->modifyRegister(REG_CONTROL, 0, MASK_ALARM_2_INT_ENABLE);   // Set the A2IE bit of 0x0E
     if(res) cerr << "RTC: Unable to enable Alarm 2" << endl;
     return res;
 }
@@ -669,9 +1273,7 @@ int RTC::enableInterruptAlarm2()
  */
 int RTC::disableInterruptAlarm2()
 {
-    uint8_t control_reg = this->readRegister(REG_CONTROL);  // Read the Control register 0x0E        
-    control_reg &= ~(MASK_ALARM_2_INT_ENABLE);              // clear the A2IE bit
-    int res = this->writeRegister(REG_CONTROL, control_reg);// Write the modified value back to 0x0E
+    int res = this->modifyRegister(REG_CONTROL, MASK_ALARM_2_INT_ENABLE, 0);   // Clear the A2IE bit of 0x0E
     if(res) cerr << "RTC: Unable to disable Alarm 2" << endl;
     return res;
 }
@@ -692,32 +1294,70 @@ int RTC::disableInterruptAlarm2()
  */
 int RTC::enableSquareWave(sqw_frequency freq)
 {
-    uint8_t control_reg = this->readRegister(REG_CONTROL); // Read the control register 0x0E
     // Clear A1IE, A2IE, INTCN, RS2 and RS1 bits
-    control_reg &= ~(MASK_ALARM_1_INT_ENABLE | MASK_ALARM_2_INT_ENABLE | MASK_INTERRUPT_CONTROL | MASK_RATE_SELECT_1 | MASK_RATE_SELECT_2);
-    // set RS1 and RS2 to the frequency specified
-    control_reg |= (freq << 3);
-    // set the BBSQW bit 
-    control_reg |= MASK_BAT_BACKUP_SQW_ENABLE;
-    // write the modified value back to 0x0E
-    int res = this->writeRegister(REG_CONTROL, control_reg);
+    uint8_t clear_mask = field_control_alarm_1_int_enabled::mask | field_control_alarm_2_int_enabled::mask |
+                         field_control_interrupt_control::mask | field_control_sqw_rate::mask;
+    // set RS1 and RS2 to the frequency specified and set the BBSQW bit
+    uint8_t set_mask = field_control_sqw_rate::encode(freq) | field_control_battery_backed_sqw::encode(true);
+    // write the modified value of 0x0E
+    int res = this->modifyRegister(REG_CONTROL, clear_mask, set_mask);
     if(res) cerr << "RTC: Unable to enable Square wave" << endl;
     return res;
 }
 
 int RTC::setState32kHz(state_32kHz state)
 {
-    uint8_t status_reg = this->readRegister(REG_STATUS);    // Read the status register 0x0F
-    // if the state is ON, then set the EN32kHz bit
-    if(state == ON) status_reg |= MASK_ENABLE_32KHZ_OUT;                 
-    // if the state is HIGH_IMPEDANCE, then clear the EN32kHz bit
-    else status_reg &= ~(MASK_ENABLE_32KHZ_OUT);
-    // write the modified status register
-    int res = this->writeRegister(REG_STATUS, status_reg);
-    if(res) cerr << "Unable to set state of 32kHz pin" << endl;
+    if(this->loadShadow()) return 1;
+    // set the EN32kHz bit if the state is ON, clear it if the state is HIGH_IMPEDANCE
+    uint8_t status_reg = field_status_enable_32kHz::update(this->shadow[REG_STATUS], state == ON);
+    if(status_reg == this->shadow[REG_STATUS]) return 0;
+    this->shadow[REG_STATUS] = status_reg;
+    // write the status register without clearing any flags
+    int res = this->writeStatus(0);
+    if(res)
+    {
+        this->shadowValid = false;
+        cerr << "Unable to set state of 32kHz pin" << endl;
+    }
     return res;
 }
 
+/**
+ * Reads the aging offset, the trim of the crystal oscillator. It only changes when it is written,
+ * so it comes from the shadow copy of the register file.
+ * 
+ * @param offset Receives the aging offset, in two's complement steps of about 0.1ppm, positive slows the clock
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::getAgingOffset(int8_t& offset)
+{
+    if(this->loadShadow()) return 1;
+    offset = static_cast<int8_t>(this->shadow[REG_AGING_OFFSET]);
+    return 0;
+}
+
+/**
+ * Writes the aging offset, the trim of the crystal oscillator. The DS3231 only applies it at the
+ * next temperature conversion, so one is started straight away unless `convertNow` is false.
+ * 
+ * @param offset The aging offset, in two's complement steps of about 0.1ppm, positive slows the clock
+ * @param convertNow If true, a temperature conversion is started so the offset takes effect now
+ * 
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTC::setAgingOffset(int8_t offset, bool convertNow)
+{
+    uint8_t value = static_cast<uint8_t>(offset);
+    if(this->writeShadow(REG_AGING_OFFSET, &value, 1))
+    {
+        cerr << "RTC: Unable to set the aging offset" << endl;
+        return 1;
+    }
+    if(!convertNow) return 0;
+    return this->startTemperatureConversion();
+}
+
 /**
  * Prints the values of a shared memory safe `user_time_ptr_t` pointer to a `user_time_t` struct
  * @param timePtr timePtr is the pointer to a struct that contains information about the time.
@@ -762,7 +1402,11 @@ void RTC::displayTime()
  */
 void RTC::printUserAlarm(user_alarm_ptr_t alarm_ptr)
 {
-
+    if (alarm_ptr == nullptr)
+    {
+        cerr << "Error: Null pointer provided." << endl;
+        return;
+    }
     cout << "Time: ";
     if (alarm_ptr->alarm_num == 1)
     {
@@ -882,6 +1526,8 @@ void RTC::displayAlarm2()
  */
 RTC::~RTC()
 {
+    // let a requested temperature conversion finish before the bus goes away
+    if(this->conversionThread.joinable()) this->conversionThread.join();
     // close the I2C device file associated with the RTC 
-    this->close();
+    this->i2c->close();
 }
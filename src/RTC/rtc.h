@@ -5,6 +5,11 @@
 #include <unistd.h>
 #include <ctime>
 #include <memory>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 // TIME REGISTERS
 #define REG_TIME_SECONDS            0x00
@@ -60,6 +65,15 @@
 #define REG_TEMPERATURE_MSB         0x11
 #define REG_TEMPERATURE_LSB         0x12
 
+// Number of registers in the DS3231 register file (0x00 through 0x12)
+#define DS3231_NUM_REGISTERS        0x13
+
+// Number of writable registers (0x00 through 0x10), the temperature registers are read only
+#define DS3231_NUM_WRITABLE         0x11
+
+// Unchanged registers apply() resends to join two runs of changed ones into a single burst
+#define APPLY_MERGE_GAP             2
+
 // Made it difficult for the users to go wrong with inputs by defining strict ENUM inputs
 enum rate_alarm_1
 {
@@ -146,32 +160,139 @@ typedef struct user_alarm_t {
     } rate_alarm;
 } user_alarm_t;
 
+// typedef struct to store every register of the module, decoded from a single burst read
+typedef struct rtc_snapshot_t {
+    user_time_t time;
+    bool century;                   // century bit of the month register
+    user_alarm_t alarm_1;
+    user_alarm_t alarm_2;
+    // control register 0x0E
+    bool oscillator_enabled;        // EOSC is active low
+    bool battery_backed_sqw;        // BBSQW
+    bool convert_temperature;       // CONV
+    sqw_frequency sqw_rate;         // RS2 and RS1
+    bool interrupt_control;         // INTCN
+    bool alarm_2_int_enabled;       // A2IE
+    bool alarm_1_int_enabled;       // A1IE
+    // status register 0x0F
+    bool oscillator_stopped;        // OSF
+    bool enable_32kHz;              // EN32kHz
+    bool busy;                      // BSY
+    bool alarm_2_flag;              // A2F
+    bool alarm_1_flag;              // A1F
+    int8_t aging_offset;
+    float temperature;
+    uint8_t registers[DS3231_NUM_REGISTERS]; // the raw register file
+} rtc_snapshot_t;
+
+// typedef struct to describe the state to bring the module to with apply()
+typedef struct rtc_config_t {
+    bool set_time;                  // write the time below, otherwise the time registers are left alone
+    time_t time;                    // seconds since the epoch, UTC
+    CLOCK_FORMAT clock_12hr;        // format of the time registers
+    bool set_alarm_1;               // write alarm_1, otherwise 0x07 through 0x0A are left alone
+    user_alarm_t alarm_1;           // time and rate, alarm_num is ignored
+    bool set_alarm_2;               // write alarm_2, otherwise 0x0B through 0x0D are left alone
+    user_alarm_t alarm_2;
+    // control register 0x0E
+    bool oscillator_enabled;        // EOSC is active low
+    bool battery_backed_sqw;        // BBSQW
+    sqw_frequency sqw_rate;         // RS2 and RS1
+    bool interrupt_control;         // INTCN
+    bool alarm_2_int_enabled;       // A2IE
+    bool alarm_1_int_enabled;       // A1IE
+    // status register 0x0F
+    bool enable_32kHz;              // EN32kHz
+    bool clear_oscillator_stopped;  // clear OSF
+    bool clear_alarm_flags;         // clear A2F and A1F
+    bool set_aging_offset;          // write the aging offset below and convert, otherwise it is left alone
+    int8_t aging_offset;
+} rtc_config_t;
+
+// typedef struct to store the result of a requested temperature conversion
+typedef struct temperature_conversion_t {
+    int status;             // 0 if the conversion completed, 1 if it failed or timed out
+    int16_t quarters;       // the temperature in quarter degrees Celsius
+} temperature_conversion_t;
+
+using temperature_callback_t = std::function<void(const temperature_conversion_t&)>;
+
 // Shared pointers for memory safe operation
 using user_time_ptr_t = std::shared_ptr<user_time_t>;
 using user_alarm_ptr_t = std::shared_ptr<user_alarm_t>;
 
-class RTC: private EE513::I2CDevice {
+/**
+ * @class RTC
+ * @brief Driver of the DS3231 real-time clock, over a bus backend.
+ *
+ * The RTC is used from one thread, the thread that owns it; only requestTemperatureConversion()
+ * runs bus transactions on a background thread of its own. Every transaction goes through
+ * busRead() and busWrite(), which hold busLock for the whole transaction: the fallback path of
+ * I2CDevice for adapters without I2C_FUNC_I2C sends the register pointer and reads the data in two
+ * separate syscalls, and a transaction of the other thread must not land between them.
+ */
+class RTC {
 private:
+    std::unique_ptr<EE513::BusDevice> i2c;  // the bus backend the DS3231 registers are accessed through
+    std::mutex busLock;                     // held for each transaction on i2c
+    int busRead(unsigned int fromAddress, unsigned char* buffer, unsigned int number);
+    int busWrite(unsigned int fromAddress, const unsigned char* values, unsigned int number);
+    uint8_t shadow[DS3231_NUM_REGISTERS];   // shadow copy of the register file, see loadShadow()
+    bool shadowValid;
+    int loadShadow();
+    int writeShadow(uint8_t fromAddress, const uint8_t* values, uint8_t number);
+    int modifyRegister(uint8_t registerAddress, uint8_t clearMask, uint8_t setMask);
+    int writeStatus(uint8_t clearFlags);
+    int writeTimeRegisters(const uint8_t* regs);
+    int startTemperatureConversion();
+    void waitTemperatureConversion(int timeoutMs);
+    std::mutex conversionLock;              // guards the two members below
+    std::vector<temperature_callback_t> conversionWaiters;
+    bool conversionRunning;
+    std::thread conversionThread;           // polls BSY/CONV while a requested conversion runs
     uint8_t BCD_to_decimal(uint8_t BCD_value);
     uint8_t decimal_to_BCD(uint8_t decimal);
-    int setTimeAlarm(uint8_t alarm_num, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date);
-    rate_alarm_1 getRateAlarm1(uint8_t* alarm_1_regs);
-    rate_alarm_2 getRateAlarm2(uint8_t* alarm_2_regs);
+    int encodeAlarm(uint8_t alarm_num, uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date, uint8_t* regs);
+    int setTimeAlarm(uint8_t alarm_num, uint8_t seconds, uint8_t minutes, CLOCK_FORMAT clock_12_hr, AM_OR_PM am_pm, uint8_t hours, DAY_OR_DATE day_or_date, uint8_t day_date);
+    rate_alarm_1 getRateAlarm1(const uint8_t* alarm_1_regs);
+    rate_alarm_2 getRateAlarm2(const uint8_t* alarm_2_regs);
+    void decodeTime(const uint8_t* data, user_time_t& t);
+    void decodeAlarm1(const uint8_t* alarm_1_regs, user_alarm_t& alarm_1);
+    void decodeAlarm2(const uint8_t* alarm_2_regs, user_alarm_t& alarm_2);
+    int16_t decodeTemperature(const uint8_t* temperature_regs);
     void printUserTime(user_time_ptr_t timePtr);
     void printUserAlarm(user_alarm_ptr_t alarm_ptr);
 
 public:
     RTC(unsigned int bus, unsigned int device);
+    RTC(std::unique_ptr<EE513::BusDevice> device);
     user_time_ptr_t getTime();
+    int getTime(user_time_t& t);
+    int getSeconds(uint8_t& seconds);
+    int getEpoch(time_t& epoch);
     int setTime(uint8_t seconds=0, uint8_t minutes=0, CLOCK_FORMAT clock_12_hr=FORMAT_0_23, AM_OR_PM am_pm=AM, uint8_t hours=0, uint8_t day_of_week=1, uint8_t date_of_month=1, uint8_t month=1, uint8_t year=0);
     int setCurrentTimeToRTC(CLOCK_FORMAT clock_12_hr);
+    int setCurrentTimeToRTCAligned(CLOCK_FORMAT clock_12_hr, int64_t leadNs = 0);
     float getTemperature();
+    int getTemperatureQuarters(int16_t& quarters);
+    int getTemperatureQuarters(int16_t& quarters, bool& busy);
+    int requestTemperatureConversion(temperature_callback_t callback, int timeoutMs = 1000);
+    std::future<temperature_conversion_t> requestTemperatureConversion(int timeoutMs = 1000);
+    int snapshot(rtc_snapshot_t& snap);
+    int apply(const rtc_config_t& config);
+    int apply(const rtc_config_t& config, int& bursts);
     int setTimeAlarm1(uint8_t seconds=0, uint8_t minutes=0, CLOCK_FORMAT clock_12_hr=FORMAT_0_23, AM_OR_PM am_pm=AM, uint8_t hours=0, DAY_OR_DATE day_or_date=DAY_OF_WEEK, uint8_t day_date=1);
     int setTimeAlarm2(uint8_t minutes=0, CLOCK_FORMAT clock_12_hr=FORMAT_0_23, AM_OR_PM am_pm=AM, uint8_t hours=0, DAY_OR_DATE day_or_date=DAY_OF_WEEK, uint8_t day_date=1);
     user_alarm_ptr_t getAlarm1();
     user_alarm_ptr_t getAlarm2();
+    int getAlarm1(user_alarm_t& alarm_1);
+    int getAlarm2(user_alarm_t& alarm_2);
     int setRateAlarm1(rate_alarm_1 rate);
     int setRateAlarm2(rate_alarm_2 rate);
+    int setAlarmsAt(time_t alarm1At, time_t alarm2At, CLOCK_FORMAT clock_12_hr = FORMAT_0_23);
+    int setAlarm1Registers(const uint8_t* regs);
+    int getAlarmFlags(uint8_t& flags);
+    int clearAlarmFlags(uint8_t flags);
     int snoozeAlarm1();
     int snoozeAlarm2();
     int enableInterruptAlarm1();
@@ -180,9 +301,12 @@ public:
     int disableInterruptAlarm2();
     int enableSquareWave(sqw_frequency freq); // disables alarms
     int setState32kHz(state_32kHz state);
+    int getAgingOffset(int8_t& offset);
+    int setAgingOffset(int8_t offset, bool convertNow = true);
     void displayTime();
     void displayAlarm1();
     void displayAlarm2();
+    void invalidateCache();
     ~RTC();
 };
 
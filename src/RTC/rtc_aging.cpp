@@ -0,0 +1,172 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "rtc_aging.h"
+#include "rtc_discipline.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+#define MIN_SAMPLES             4           // samples the drift has to be fitted to before a step
+#define MAX_OFFSET_ERROR_NS     1000000LL   // measurements less certain than this are not used
+
+/**
+ * Creates a calibrator. Nothing is measured or written until the first update.
+ *
+ * @param rtc The RTC to trim, it must outlive the calibrator.
+ * @param detector The detector to measure the RTC against the system clock with, for the same RTC.
+ * @param historyPath The file the calibration steps are appended to.
+ * @param strategy EDGE_POLL_SECONDS or EDGE_SQW_GPIO, how the detector finds the seconds rollover.
+ * @param intervalSeconds The time between measurements in run().
+ * @param minimumSpanSeconds How long the drift has to be measured over before the aging offset is changed.
+ * @param ntpMaxErrorUs NTP counts as available while the maximum error the kernel reports stays below this.
+ */
+AgingCalibrator::AgingCalibrator(RTC& rtc, SecondsEdgeDetector& detector, const std::string& historyPath,
+                                 edge_strategy strategy, int intervalSeconds, double minimumSpanSeconds, long ntpMaxErrorUs)
+    : rtc(rtc), detector(detector), historyPath(historyPath)
+{
+    this->strategy           = strategy;
+    this->intervalSeconds    = intervalSeconds;
+    this->minimumSpanSeconds = minimumSpanSeconds;
+    this->ntpMaxErrorUs      = ntpMaxErrorUs;
+}
+
+/**
+ * Appends a calibration step to the history file as
+ * time,aging before,aging after,drift ppm,span seconds,temperature
+ * with the temperature left empty if it could not be read.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int AgingCalibrator::appendHistory(const aging_record_t& record)
+{
+    ofstream history(this->historyPath.c_str(), ios::app);
+    history << static_cast<long long>(record.time) << ',' << static_cast<int>(record.agingBefore) << ','
+            << static_cast<int>(record.agingAfter) << ',' << record.driftPpm << ',' << record.spanSeconds << ',';
+    if(!isnan(record.temperature)) history << record.temperature;
+    history << '\n';
+    history.flush();
+    if(!history)
+    {
+        cerr << "RTC: Unable to write the calibration history to " << this->historyPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reads the last calibration step from the history file, e.g. to report it after a restart.
+ *
+ * @param record The `aging_record_t` to fill
+ *
+ * @return 0 if successful, 1 if there is no history
+ */
+int AgingCalibrator::lastRecord(aging_record_t& record)
+{
+    ifstream history(this->historyPath.c_str());
+    string line, last;
+    while(getline(history, line)) if(!line.empty()) last = line;
+    if(last.empty()) return 1;
+
+    long long time;
+    int before, after;
+    char comma;
+    string temperature;
+    istringstream fields(last);
+    fields >> time >> comma >> before >> comma >> after >> comma >> record.driftPpm >> comma
+           >> record.spanSeconds >> comma;
+    bool parsed = !fields.fail() && comma == ',';
+    getline(fields, temperature);   // empty if the temperature could not be read
+    char* end = NULL;
+    record.temperature = temperature.empty() ? NAN : strtof(temperature.c_str(), &end);
+    if(!parsed || (end && (end == temperature.c_str() || *end != '\0')))
+    {
+        cerr << "RTC: Unable to parse the calibration history line: " << last << endl;
+        return 1;
+    }
+    record.time        = static_cast<time_t>(time);
+    record.agingBefore = static_cast<int8_t>(before);
+    record.agingAfter  = static_cast<int8_t>(after);
+    return 0;
+}
+
+/**
+ * Takes one drift measurement and, once the drift has been measured for long enough, programs the
+ * aging offset that cancels it. It blocks until the next seconds rollover of the RTC.
+ *
+ * @param stepped Set to true if a calibration step was taken and `record` was filled
+ * @param record The `aging_record_t` to fill with the step
+ *
+ * @return 0 if successful (also when the sample was skipped because NTP is unavailable), 1 if unsuccessful
+ */
+int AgingCalibrator::update(bool& stepped, aging_record_t& record)
+{
+    stepped = false;
+    double freqPpm;
+    int synced = system_clock_ntp_synchronised(this->ntpMaxErrorUs, freqPpm);
+    if(synced < 0) return 1;
+    if(!synced) return 0;   // without NTP the system clock is no reference
+
+    int64_t offsetNs, errorNs;
+    if(this->detector.measureSystemOffset(offsetNs, errorNs, this->strategy)) return 1;
+    if(errorNs > MAX_OFFSET_ERROR_NS) return 0;
+    double t = monotonic_seconds();
+    this->drift.add(t, static_cast<double>(offsetNs));
+    if(this->drift.count() < MIN_SAMPLES || this->drift.span() < this->minimumSpanSeconds) return 0;
+
+    int8_t aging;
+    if(this->rtc.getAgingOffset(aging)) return 1;
+    double driftPpm = this->drift.slope() * 1e-3;     // ns per second to ppm
+    // a fast RTC needs a larger offset to slow it down
+    long target = lround(aging + driftPpm / AGING_PPM_PER_LSB);
+    if(target > 127) target = 127;
+    if(target < -128) target = -128;
+
+    record.time        = time(NULL);
+    record.agingBefore = aging;
+    record.agingAfter  = static_cast<int8_t>(target);
+    record.driftPpm    = driftPpm;
+    record.spanSeconds = this->drift.span();
+    int16_t quarters;
+    record.temperature = this->rtc.getTemperatureQuarters(quarters) ? NAN : quarters / 4.0f;
+    if(record.agingAfter != aging && this->rtc.setAgingOffset(record.agingAfter)) return 1;
+    this->drift.reset();    // the next step measures the drift with the new offset
+    stepped = true;
+    return this->appendHistory(record);
+}
+
+/**
+ * Runs the calibration as a daemon, one measurement every intervalSeconds until `running` is
+ * cleared, e.g. by a signal handler.
+ *
+ * @param running The loop stops when this becomes false
+ *
+ * @return 0 when stopped, 1 if the wait for the next update failed
+ */
+int AgingCalibrator::run(volatile bool& running)
+{
+    aging_record_t record;
+    if(!this->lastRecord(record))
+        cout << "Last calibration: aging offset " << static_cast<int>(record.agingAfter) << " for a drift of "
+             << record.driftPpm << "ppm" << endl;
+    int64_t next = monotonic_ns();
+    while(running)
+    {
+        bool stepped;
+        if(this->update(stepped, record)) cerr << "RTC: Calibration update failed" << endl;
+        else if(stepped)
+            cout << "Drift " << record.driftPpm << "ppm over " << record.spanSeconds << "s at " << record.temperature
+                 << "C: aging offset " << static_cast<int>(record.agingBefore) << " -> "
+                 << static_cast<int>(record.agingAfter) << endl;
+        next += static_cast<int64_t>(this->intervalSeconds) * NS_PER_SECOND;
+        if(sleep_until_ns(CLOCK_MONOTONIC, next, &running) && running)
+        {
+            cerr << "RTC: Unable to wait for the next calibration update" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
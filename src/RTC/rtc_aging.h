@@ -0,0 +1,59 @@
+#ifndef RTC_AGING_H_
+#define RTC_AGING_H_
+
+#include "rtc_edge.h"
+#include "linear_fit.h"
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+#define AGING_PPM_PER_LSB   0.1     // typical effect of one step of the aging offset at 25 degrees
+
+// typedef struct to store one step of the aging offset calibration, one line of the history file
+typedef struct aging_record_t {
+    time_t time;            // when the step was taken
+    int8_t agingBefore;     // the aging offset the drift was measured with
+    int8_t agingAfter;      // the aging offset programmed for it
+    double driftPpm;        // the measured drift of the RTC, positive if it runs fast
+    double spanSeconds;     // how long the drift was measured over
+    float temperature;      // the temperature of the RTC at the end of the measurement, NAN if unread
+} aging_record_t;
+
+/**
+ * @class AgingCalibrator
+ * @brief Trims the DS3231 oscillator with the aging offset until the RTC keeps NTP time.
+ *
+ * Every update measures the offset between the RTC and the system clock at a seconds rollover,
+ * while the kernel reports that NTP synchronises the system clock; other samples are skipped. Once
+ * the samples span minimumSpanSeconds the slope of their fit is the drift of the RTC, which is
+ * turned into whole steps of the aging offset (about 0.1ppm each, positive slows the clock) and
+ * programmed. The fit then starts again, so each step measures the result of the last one and the
+ * offset converges even though the ppm per step varies between parts and with temperature.
+ *
+ * Every step is appended to the history file as a line of comma separated values, which survives
+ * restarts and shows the aging of the crystal over the life of the unit.
+ */
+class AgingCalibrator {
+private:
+    RTC& rtc;
+    SecondsEdgeDetector& detector;
+    std::string historyPath;
+    edge_strategy strategy;
+    int intervalSeconds;
+    double minimumSpanSeconds;
+    long ntpMaxErrorUs;
+    LinearFit drift;            // RTC minus system clock in ns against CLOCK_MONOTONIC in s
+
+    int appendHistory(const aging_record_t& record);
+
+public:
+    AgingCalibrator(RTC& rtc, SecondsEdgeDetector& detector, const std::string& historyPath,
+                    edge_strategy strategy = EDGE_POLL_SECONDS, int intervalSeconds = 600,
+                    double minimumSpanSeconds = 21600.0, long ntpMaxErrorUs = 500000);
+    int update(bool& stepped, aging_record_t& record);
+    int run(volatile bool& running);
+    int lastRecord(aging_record_t& record);
+    double currentDriftPpm() { return this->drift.slope() * 1e-3; }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <iostream>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <system_error>
+
+#include "rtc_alarm.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+/**
+ * Creates the service. The GPIO line is only requested by start().
+ *
+ * @param rtc The RTC whose alarms are served, it must outlive the service.
+ * @param gpioChip The GPIO chip the INT/SQW pin is connected to, e.g. "gpiochip0" ("gpiochip4" on a Pi 5).
+ * @param gpioLine The line offset of the INT/SQW pin on that chip.
+ */
+AlarmService::AlarmService(RTC& rtc, const std::string& gpioChip, unsigned int gpioLine)
+    : rtc(rtc), gpioChip(gpioChip), gpioLine(gpioLine), epollFd(-1), requested(false), started(false)
+{
+}
+
+/**
+ * Requests the INT/SQW line for falling edge events and registers its event fd with epoll. An
+ * alarm that fired before the service started holds INT/SQW low without a new edge; it is served
+ * by the first dispatch() that times out, e.g. dispatch(0), which run() starts with.
+ *
+ * @return 0 if the line is watched, 1 if unsuccessful
+ */
+int AlarmService::start()
+{
+    if(this->started) return 0;
+    try
+    {
+        this->chip = gpiod::chip(this->gpioChip);
+        this->line = this->chip.get_line(this->gpioLine);
+        this->line.request({"ds3231-alarm", gpiod::line_request::EVENT_FALLING_EDGE, 0});
+        this->requested = true;
+        this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if(this->epollFd < 0)
+        {
+            this->stop();
+            cerr << "RTC: Unable to create the alarm epoll instance" << endl;
+            return 1;
+        }
+        struct epoll_event event = {};
+        event.events  = EPOLLIN;
+        event.data.fd = this->line.event_get_fd();
+        if(epoll_ctl(this->epollFd, EPOLL_CTL_ADD, event.data.fd, &event) != 0)
+        {
+            this->stop();
+            cerr << "RTC: Unable to watch the alarm line" << endl;
+            return 1;
+        }
+        this->started = true;
+    }
+    catch(const system_error& e)
+    {
+        this->stop();
+        cerr << "RTC: Unable to request the alarm line: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// true if the requested INT/SQW line reads low, i.e. a flag may still hold it
+bool AlarmService::lineLow()
+{
+    if(!this->requested) return false;
+    try
+    {
+        return this->line.get_value() == 0;
+    }
+    catch(const system_error& e)
+    {
+        cerr << "RTC: Unable to read the alarm line: " << e.what() << endl;
+        return false;
+    }
+}
+
+/**
+ * Reads the alarm flags in one transaction, clears the ones that fired in one write and calls
+ * their callbacks.
+ *
+ * @param fired Receives the flags that were set, 0 if none or the read failed
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int AlarmService::serveFlags(int64_t edgeNs, uint8_t& fired)
+{
+    fired = 0;
+    if(this->rtc.getAlarmFlags(fired)) return 1;
+    if(!fired) return 0;    // e.g. the square wave is enabled instead of the alarms
+    if(this->rtc.clearAlarmFlags(fired)) return 1;
+    if((fired & MASK_ALARM_1_FLAG) && this->alarm1Callback) this->alarm1Callback(edgeNs);
+    if((fired & MASK_ALARM_2_FLAG) && this->alarm2Callback) this->alarm2Callback(edgeNs);
+    return 0;
+}
+
+/**
+ * Serves one interrupt: reads the alarm flags in one transaction, clears the ones that fired in
+ * one write and calls their callbacks. While the service holds the line, this is repeated until
+ * INT/SQW is high, up to ALARM_SERVE_ATTEMPTS times. It can also be called directly, e.g. by a
+ * caller that watches INT/SQW some other way.
+ *
+ * @param edgeNs CLOCK_MONOTONIC of the falling edge, handed to the callbacks
+ *
+ * @return 0 if successful, 1 if unsuccessful or INT/SQW is still low
+ */
+int AlarmService::handleInterrupt(int64_t edgeNs)
+{
+    for(int attempt = 0; attempt < ALARM_SERVE_ATTEMPTS; attempt++)
+    {
+        uint8_t fired;
+        int res = this->serveFlags(edgeNs, fired);
+        if(!res && !fired) return 0;            // no alarm holds the line
+        if(!this->lineLow()) return res;
+    }
+    cerr << "RTC: INT/SQW stays low after serving the alarms" << endl;
+    return 1;
+}
+
+/**
+ * Sleeps in epoll_wait() until INT/SQW falls or the timeout expires, then serves the interrupt.
+ * When the timeout expires with INT/SQW low, which no edge will report, it is served as well. A
+ * signal ends the wait early, without an error.
+ *
+ * @param timeoutMs How long to wait, -1 waits until an edge
+ *
+ * @return 0 if successful (also on timeout or signal), 1 if unsuccessful
+ */
+int AlarmService::dispatch(int timeoutMs)
+{
+    if(!this->started && this->start()) return 1;
+    struct epoll_event event;
+    int ready = epoll_wait(this->epollFd, &event, 1, timeoutMs);
+    if(ready < 0)
+    {
+        if(errno == EINTR) return 0;
+        cerr << "RTC: Unable to wait for the alarm line" << endl;
+        return 1;
+    }
+    if(ready == 0) return this->lineLow() ? this->handleInterrupt(monotonic_ns()) : 0;
+    try
+    {
+        gpiod::line_event edge = this->line.event_read();
+        if(edge.event_type != gpiod::line_event::FALLING_EDGE) return 0;
+        return this->handleInterrupt(edge.timestamp.count());
+    }
+    catch(const system_error& e)
+    {
+        cerr << "RTC: Unable to read the alarm line: " << e.what() << endl;
+        return 1;
+    }
+}
+
+/**
+ * Serves alarms until `running` is cleared, e.g. by a signal handler, whose signal also ends the
+ * wait in progress. Nothing runs between alarms. The first dispatch does not wait, so flags that
+ * were pending before the start are served right away. After a failed dispatch, which may leave INT/SQW
+ * low without another edge, the line is polled from ALARM_RETRY_MS on, backing off up to
+ * ALARM_RETRY_MAX_MS, until a dispatch succeeds.
+ *
+ * @param running The loop stops when this becomes false
+ *
+ * @return 0 when stopped, 1 if the line could not be watched
+ */
+int AlarmService::run(volatile bool& running)
+{
+    if(this->start()) return 1;
+    int timeoutMs = 0;
+    while(running)
+    {
+        if(!this->dispatch(timeoutMs)) timeoutMs = -1;
+        else if(timeoutMs < 0) timeoutMs = ALARM_RETRY_MS;
+        else timeoutMs = timeoutMs * 2 < ALARM_RETRY_MAX_MS ? timeoutMs * 2 : ALARM_RETRY_MAX_MS;
+    }
+    return 0;
+}
+
+/**
+ * Stops watching the line and releases it.
+ */
+void AlarmService::stop()
+{
+    if(this->epollFd >= 0)
+    {
+        ::close(this->epollFd);
+        this->epollFd = -1;
+    }
+    if(this->requested) this->line.release();
+    this->requested = false;
+    this->started   = false;
+}
+
+AlarmService::~AlarmService()
+{
+    this->stop();
+}
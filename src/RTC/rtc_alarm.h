@@ -0,0 +1,67 @@
+#ifndef RTC_ALARM_H_
+#define RTC_ALARM_H_
+
+#include "rtc.h"
+#include <stdint.h>
+#include <string>
+#include <functional>
+#include <gpiod.hpp>
+
+// Times the flags are served while INT/SQW stays low before handleInterrupt() gives up
+#define ALARM_SERVE_ATTEMPTS        4
+
+// run() polls INT/SQW at this interval after a failed dispatch, doubling up to the maximum
+#define ALARM_RETRY_MS              100
+#define ALARM_RETRY_MAX_MS          5000
+
+// Called with the CLOCK_MONOTONIC timestamp of the INT/SQW falling edge that reported the alarm
+using alarm_callback_t = std::function<void(int64_t edgeNs)>;
+
+/**
+ * @class AlarmService
+ * @brief Reacts to the DS3231 alarms on the falling edge of INT/SQW instead of polling the flags.
+ *
+ * The INT/SQW pin is requested for falling edge events through libgpiod and its event fd is
+ * waited on with epoll, so the thread sleeps in the kernel until an alarm fires. On an edge the
+ * status register is read in one transaction, the flags that fired are cleared in one write (which
+ * releases INT/SQW for the next alarm) and the callbacks of those alarms are called. The alarms
+ * themselves are set up as usual with setTimeAlarm1/2(), which also enable their interrupts, and
+ * setRateAlarm1/2().
+ *
+ * INT/SQW is held low while any enabled flag is set, and only a falling edge wakes the service. A
+ * flag that fires between the read and the clear, or a clear that fails on the bus, would keep it
+ * low with no further edge, so the flags are served again until the line is high, and run() polls
+ * the line with a growing timeout after a failure until it is served. A flag pending before start()
+ * is the same case: run() polls once before it waits for the first edge.
+ *
+ * The callbacks run on the thread that calls dispatch() or run(); they may use the RTC from there.
+ */
+class AlarmService {
+private:
+    RTC& rtc;
+    std::string gpioChip;
+    unsigned int gpioLine;
+    gpiod::chip chip;
+    gpiod::line line;
+    int epollFd;
+    bool requested;             // the line is held
+    bool started;               // the line is requested and watched by epoll
+    alarm_callback_t alarm1Callback;
+    alarm_callback_t alarm2Callback;
+
+    int serveFlags(int64_t edgeNs, uint8_t& fired);
+    bool lineLow();
+
+public:
+    AlarmService(RTC& rtc, const std::string& gpioChip, unsigned int gpioLine);
+    void onAlarm1(alarm_callback_t callback) { this->alarm1Callback = callback; }
+    void onAlarm2(alarm_callback_t callback) { this->alarm2Callback = callback; }
+    int start();
+    int dispatch(int timeoutMs = -1);
+    int handleInterrupt(int64_t edgeNs);
+    int run(volatile bool& running);
+    void stop();
+    ~AlarmService();
+};
+
+#endif
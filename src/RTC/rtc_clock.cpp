@@ -0,0 +1,130 @@
+#include <iostream>
+
+#include "rtc_clock.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+/**
+ * Creates a clock on top of an RTC. Nothing is read from the RTC until the first call to now().
+ *
+ * @param rtc The RTC to anchor to, it must outlive the clock.
+ * @param reanchorIntervalNs The time between RTC readings once the target resolution is reached.
+ * @param resolutionNs The uncertainty to refine the anchor to by reading at the seconds rollover.
+ * @param maxDriftPpm The largest rate difference expected between the RTC and CLOCK_MONOTONIC.
+ */
+RTCClock::RTCClock(RTC& rtc, int64_t reanchorIntervalNs, int64_t resolutionNs, double maxDriftPpm) : rtc(rtc)
+{
+    this->reanchorIntervalNs = reanchorIntervalNs;
+    this->resolutionNs       = resolutionNs;
+    this->maxDriftPpm        = maxDriftPpm;
+    this->anchored           = false;
+    this->offsetLowNs        = 0;
+    this->offsetHighNs       = 0;
+    this->lastReadNs         = 0;
+    this->nextReadNs         = 0;
+}
+
+/**
+ * Reads the RTC once and narrows the offset interval with the reading.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTCClock::readAnchor()
+{
+    time_t epoch;
+    int64_t before = monotonic_ns();
+    if(this->rtc.getEpoch(epoch)) return 1;
+    int64_t after = monotonic_ns();
+    int64_t rtcNs = static_cast<int64_t>(epoch) * NS_PER_SECOND;
+
+    // The registers were sampled somewhere between before and after, at a time in [rtcNs, rtcNs + 1s)
+    int64_t low  = rtcNs - after;
+    int64_t high = rtcNs + NS_PER_SECOND - before;
+    if(this->anchored)
+    {
+        // allow for the drift since the last reading, then keep what agrees with both
+        int64_t drift = static_cast<int64_t>((after - this->lastReadNs) * this->maxDriftPpm * 1e-6);
+        int64_t prevLow  = this->offsetLowNs - drift;
+        int64_t prevHigh = this->offsetHighNs + drift;
+        if(low < prevLow) low = prevLow;
+        if(high > prevHigh) high = prevHigh;
+    }
+    if(low > high)
+    {
+        // the reading does not fit the anchor, the RTC or the system has been set: start again
+        low  = rtcNs - after;
+        high = rtcNs + NS_PER_SECOND - before;
+    }
+    this->offsetLowNs  = low;
+    this->offsetHighNs = high;
+    this->lastReadNs   = after;
+    this->anchored     = true;
+    this->scheduleNextRead(after);
+    return 0;
+}
+
+/**
+ * Decides when the RTC has to be read next. While the offset interval is wider than the target
+ * resolution the reading is placed at the rollover predicted by the middle of the interval, which
+ * cuts the interval in half whichever way the rollover actually happened.
+ *
+ * @param monotonicNs CLOCK_MONOTONIC of the last reading
+ */
+void RTCClock::scheduleNextRead(int64_t monotonicNs)
+{
+    if(this->offsetHighNs - this->offsetLowNs <= this->resolutionNs)
+    {
+        this->nextReadNs = monotonicNs + this->reanchorIntervalNs;
+        return;
+    }
+    int64_t middle = (this->offsetLowNs + this->offsetHighNs) / 2;
+    int64_t estimate = monotonicNs + middle;
+    int64_t nextSecond = (estimate / NS_PER_SECOND + 1) * NS_PER_SECOND;
+    this->nextReadNs = nextSecond - middle;
+}
+
+/**
+ * Returns the RTC time extrapolated from the anchor with CLOCK_MONOTONIC. The RTC is only read
+ * when the anchor is due to be refined or refreshed, otherwise no bus transaction happens.
+ * The time is the UTC time that the RTC holds, as seconds and nanoseconds since the epoch.
+ *
+ * @param ts The timespec to fill
+ *
+ * @return 0 if successful, 1 if the RTC could not be read
+ */
+int RTCClock::now(struct timespec& ts)
+{
+    int64_t monotonic = monotonic_ns();
+    if(!this->anchored || monotonic >= this->nextReadNs)
+    {
+        if(this->readAnchor()) return 1;
+        monotonic = monotonic_ns();
+    }
+    int64_t epochNs = monotonic + (this->offsetLowNs + this->offsetHighNs) / 2;
+    ts.tv_sec  = epochNs / NS_PER_SECOND;
+    ts.tv_nsec = epochNs % NS_PER_SECOND;
+    return 0;
+}
+
+/**
+ * Forgets the anchor and reads the RTC again, e.g. after the RTC has been set.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int RTCClock::reanchor()
+{
+    this->anchored = false;
+    return this->readAnchor();
+}
+
+/**
+ * Returns the half width of the offset interval, the largest error of now() due to the anchor.
+ *
+ * @return the uncertainty in nanoseconds, -1 if the clock has not been anchored yet
+ */
+int64_t RTCClock::uncertaintyNs()
+{
+    if(!this->anchored) return -1;
+    return (this->offsetHighNs - this->offsetLowNs) / 2;
+}
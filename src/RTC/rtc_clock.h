@@ -0,0 +1,44 @@
+#ifndef RTC_CLOCK_H_
+#define RTC_CLOCK_H_
+
+#include "rtc.h"
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @class RTCClock
+ * @brief Cached time source that anchors to RTC readings at known CLOCK_MONOTONIC instants and
+ * extrapolates between them, so that now() costs a clock_gettime() instead of a bus transaction.
+ *
+ * Every RTC reading only says that the time lies somewhere in a whole second, so the clock keeps
+ * an interval of offsets between CLOCK_MONOTONIC and the RTC that agrees with every reading, widened
+ * by the allowed drift between readings. While the interval is wider than the target resolution
+ * the next reading is taken at the predicted seconds rollover, which halves the interval each time
+ * and gives sub-second resolution. After that the clock only re-anchors periodically. A reading
+ * that disagrees with the interval (e.g. the RTC was set) starts the anchoring again.
+ *
+ * It is not thread safe, each thread should use its own RTCClock or serialise the calls.
+ */
+class RTCClock {
+private:
+    RTC& rtc;
+    int64_t reanchorIntervalNs;     // time between readings once the target resolution is reached
+    int64_t resolutionNs;           // width of the offset interval to aim for
+    double maxDriftPpm;             // drift allowed between the RTC and CLOCK_MONOTONIC
+    bool anchored;
+    int64_t offsetLowNs;            // the RTC time in ns since the epoch is CLOCK_MONOTONIC plus an
+    int64_t offsetHighNs;           // offset that lies between offsetLowNs and offsetHighNs
+    int64_t lastReadNs;             // CLOCK_MONOTONIC of the last reading
+    int64_t nextReadNs;             // CLOCK_MONOTONIC at which the next reading is due
+
+    int readAnchor();
+    void scheduleNextRead(int64_t monotonicNs);
+
+public:
+    RTCClock(RTC& rtc, int64_t reanchorIntervalNs = 60000000000LL, int64_t resolutionNs = 2000000LL, double maxDriftPpm = 5.0);
+    int now(struct timespec& ts);
+    int reanchor();
+    int64_t uncertaintyNs();
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <iostream>
+
+#include "rtc_cron.h"
+
+using namespace std;
+
+/**
+ * Creates the runtime of a compiled schedule. Nothing is programmed until arm().
+ *
+ * @param rtc The RTC whose Alarm 1 is used, it must outlive the CronAlarm.
+ * @param alarm The schedule, from cron_compile()
+ * @param callback The function to call whenever the schedule fires
+ */
+CronAlarm::CronAlarm(RTC& rtc, const cron_alarm_t& alarm, cron_callback_t callback) : rtc(rtc)
+{
+    this->alarm    = alarm;
+    this->callback = callback;
+    this->wakeups  = 0;
+    this->fires    = 0;
+    this->armed    = -1;
+    this->checked  = 0;
+}
+
+void CronAlarm::fire(time_t fired)
+{
+    this->fires++;
+    if(this->callback) this->callback(fired);
+}
+
+/**
+ * Programs Alarm 1 with the next fire time after now. The time is read again after the write, and
+ * a fire time that went by in the meantime is fired and the one after it programmed.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int CronAlarm::armFrom(time_t now)
+{
+    for(;;)
+    {
+        int64_t next = nextFireTime(this->alarm, now);
+        if(next < 0)
+        {
+            cerr << "RTC: The schedule never fires" << endl;
+            return 1;
+        }
+        uint8_t t[7];
+        rtc_epoch_to_registers(next, this->alarm.clockFormat, t);
+        const uint8_t regs[4] = {t[REG_TIME_SECONDS], t[REG_TIME_MINUTES], t[REG_TIME_HOURS], t[REG_TIME_DATE_OF_MONTH]};
+        this->armed = -1;
+        if(this->rtc.setAlarm1Registers(regs) || this->rtc.getEpoch(now)) return 1;
+        if(now < next)
+        {
+            this->armed = next;
+            return 0;
+        }
+        this->fire(static_cast<time_t>(next));
+        now = static_cast<time_t>(next);
+    }
+}
+
+/**
+ * Programs Alarm 1: the compiled hardware match, or the next fire time if the schedule re-arms.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int CronAlarm::arm()
+{
+    if(!this->alarm.valid)
+    {
+        cerr << "RTC: The schedule is not valid" << endl;
+        return 1;
+    }
+    time_t now;
+    if(this->rtc.getEpoch(now)) return 1;
+    if(this->alarm.rearm) return this->armFrom(now);
+    this->checked = now;    // hardware matches from the next second on are ours
+    return this->rtc.setAlarm1Registers(this->alarm.registers);
+}
+
+/**
+ * Serves Alarm 1. A re-armed alarm fires the time it was programmed for and programs the next one.
+ * A hardware match fires every second since the last alarm that the schedule matches, which filters
+ * the matches it does not; the time read may be later than the match, by up to CRON_LATE_SECONDS.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int CronAlarm::handleAlarm()
+{
+    time_t now;
+    if(this->rtc.getEpoch(now)) return 1;
+    this->wakeups++;
+    if(this->alarm.rearm)
+    {
+        if(this->armed < 0) return this->armFrom(now);     // the last re-arm failed, start over
+        if(now < this->armed) return 0;                     // a flag left over from before arm()
+        time_t due = static_cast<time_t>(this->armed);
+        this->fire(due);
+        return this->armFrom(due);                          // fires the times that went by since
+    }
+    time_t from = this->checked + 1;
+    if(from < now - CRON_LATE_SECONDS) from = now - CRON_LATE_SECONDS;
+    for(time_t t = from; t <= now; t++)
+        if(cron_matches(this->alarm, t)) this->fire(t);
+    if(now > this->checked) this->checked = now;
+    return 0;
+}
+
+/**
+ * Makes the service call handleAlarm() on Alarm 1.
+ *
+ * @param service The AlarmService watching the INT/SQW pin of the same RTC
+ */
+void CronAlarm::attach(AlarmService& service)
+{
+    service.onAlarm1([this](int64_t) { this->handleAlarm(); });
+}
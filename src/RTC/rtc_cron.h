@@ -0,0 +1,408 @@
+#ifndef RTC_CRON_H_
+#define RTC_CRON_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <functional>
+
+#include "rtc.h"
+#include "rtc_alarm.h"
+#include "rtc_time.h"
+
+/*
+ * Cron-like schedules compiled onto Alarm 1 of the DS3231.
+ *
+ * A schedule has six fields, "second minute hour day-of-month month day-of-week", or the classic
+ * five without the seconds (which are then 0). Every field takes `*`, a value or a range `a-b`,
+ * each optionally followed by a step `/n` (`a/n` runs from a to the end of the field), and comma
+ * separated lists of those. The day of the week is 0 (Sunday) to 6, 7 is Sunday as well. As in
+ * cron, when both day fields are restricted a day that matches either of them matches. @yearly, @monthly, @weekly, @daily and @hourly are understood.
+ *
+ * cron_compile() picks the hardware match that fires least often while never missing a match:
+ * the alarm compares the leading fields that have a single value (seconds, then minutes, hours and
+ * one of the day fields) and the A1Mx bits mask the rest. When the hardware matches more often
+ * than the schedule, the remaining fields are checked in software. If that would discard most
+ * wakeups, Alarm 1 is instead programmed with each next fire time, at the cost of one burst write
+ * per fire. Everything is constexpr, so a schedule written in the source is compiled by the
+ * compiler, and nextFireTime() gives the exact time of the next match.
+ *
+ * The registers hold UTC and the day of the week is 1 for Sunday, as setCurrentTimeToRTC() keeps them.
+ */
+
+// a search this long covers a schedule on the 29th of February across 2100, which is no leap year
+#define CRON_MAX_SEARCH_SECONDS     (9LL * 366 * SECONDS_PER_DAY)
+
+// above this many hardware matches per fire, re-arming Alarm 1 for each fire costs less than the
+// wakeups the filter would discard (a discarded wakeup reads the flags, clears them and reads the time)
+#define CRON_REARM_RATIO            2.0
+
+// how late handleAlarm() may run after a hardware match and still fire it
+#define CRON_LATE_SECONDS           10
+
+// typedef struct to store a compiled schedule
+typedef struct cron_alarm_t {
+    bool valid = false;
+    uint64_t seconds = 0;               // bit n set: the second n matches
+    uint64_t minutes = 0;
+    uint32_t hours = 0;
+    uint32_t days = 0;                  // bits 1 to 31
+    uint16_t months = 0;                // bits 1 to 12
+    uint8_t weekdays = 0;               // bit 0 for Sunday to bit 6 for Saturday
+    bool anyDay = true;                 // the day of the month field is a bare *, not */n
+    bool anyWeekday = true;             // the day of the week field is a bare *, not */n
+    CLOCK_FORMAT clockFormat = FORMAT_0_23;
+    rate_alarm_1 rate = ALARM_1_ONCE_PER_SECOND;
+    uint8_t registers[4] = {0, 0, 0, 0}; // Alarm 1 registers 0x07 through 0x0A, with the A1Mx bits
+    double wakeupsPerFire = 1.0;        // estimated hardware matches per match of the schedule
+    bool filtered = false;              // the hardware fires on times that do not match
+    bool rearm = false;                 // Alarm 1 is programmed with every next fire time instead
+} cron_alarm_t;
+
+constexpr bool cron_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+constexpr unsigned cron_count_bits(uint64_t bits)
+{
+    unsigned n = 0;
+    for(; bits; bits &= bits - 1) n++;
+    return n;
+}
+
+constexpr unsigned cron_lowest_bit(uint64_t bits)
+{
+    unsigned n = 0;
+    while(bits && !(bits & 1)) { bits >>= 1; n++; }
+    return n;
+}
+
+/**
+ * Returns the first bit at or after `from` that is set, -1 if there is none below `limit`.
+ */
+constexpr int cron_next_bit(uint64_t bits, unsigned from, unsigned limit)
+{
+    for(unsigned i = from; i < limit; i++) if((bits >> i) & 1) return static_cast<int>(i);
+    return -1;
+}
+
+constexpr bool cron_read_number(const char*& p, unsigned& value)
+{
+    if(!cron_is_digit(*p)) return false;
+    value = 0;
+    while(cron_is_digit(*p))
+    {
+        value = value * 10 + static_cast<unsigned>(*p - '0');
+        if(value > 1000) return false;
+        p++;
+    }
+    return true;
+}
+
+/**
+ * Parses one field into a bit set of the values lo through hi and moves p past it. star is only
+ * set for a bare *, a step or a list restricts the field like any other value.
+ *
+ * @return false if the field is malformed or out of range
+ */
+constexpr bool cron_parse_field(const char*& p, unsigned lo, unsigned hi, uint64_t& bits, bool& star)
+{
+    bits = 0;
+    star = (*p == '*');
+    for(;;)
+    {
+        unsigned first = lo, last = hi, step = 1;
+        bool single = false;
+        if(*p == '*') p++;
+        else
+        {
+            if(!cron_read_number(p, first)) return false;
+            last = first;
+            single = true;
+            if(*p == '-')
+            {
+                p++;
+                if(!cron_read_number(p, last)) return false;
+                single = false;
+            }
+        }
+        if(*p == '/')
+        {
+            p++;
+            if(!cron_read_number(p, step) || step == 0) return false;
+            star = false;
+            if(single) last = hi;           // "a/n" runs from a to the end of the field
+        }
+        if(first < lo || last > hi || first > last) return false;
+        for(unsigned v = first; v <= last; v += step) bits |= 1ULL << v;
+        if(*p != ',') break;
+        p++;
+        star = false;
+    }
+    if(*p != ' ' && *p != '\t' && *p != '\0') return false;
+    while(*p == ' ' || *p == '\t') p++;
+    return true;
+}
+
+constexpr bool cron_starts_with(const char* text, const char* prefix)
+{
+    while(*prefix) if(*text++ != *prefix++) return false;
+    return *text == '\0' || *text == ' ';
+}
+
+/**
+ * Estimates how often the hardware match fires per match of the schedule and fills in the
+ * Alarm 1 registers for the cheapest hardware match.
+ */
+constexpr void cron_plan(cron_alarm_t& a)
+{
+    const bool singleSecond = cron_count_bits(a.seconds) == 1;
+    const bool singleMinute = cron_count_bits(a.minutes) == 1;
+    const bool singleHour   = cron_count_bits(a.hours) == 1;
+    const uint8_t s = static_cast<uint8_t>(cron_lowest_bit(a.seconds));
+    const uint8_t m = static_cast<uint8_t>(cron_lowest_bit(a.minutes));
+    const uint8_t h = static_cast<uint8_t>(cron_lowest_bit(a.hours));
+    double ratio = 12.0 / cron_count_bits(a.months);        // the hardware never compares the month
+
+    uint8_t dayRegister = 0;
+    if(singleSecond && singleMinute && singleHour && a.anyDay && !a.anyWeekday && cron_count_bits(a.weekdays) == 1)
+    {
+        a.rate = ALARM_1_ONCE_PER_DATE_DAY;
+        dayRegister = field_alarm_1_day_or_date::encode(DAY_OF_WEEK) |
+                      field_alarm_1_day_date::encode(static_cast<uint8_t>(cron_lowest_bit(a.weekdays) + 1));
+    }
+    else if(singleSecond && singleMinute && singleHour && !a.anyDay && a.anyWeekday && cron_count_bits(a.days) == 1)
+    {
+        a.rate = ALARM_1_ONCE_PER_DATE_DAY;
+        dayRegister = field_alarm_1_day_date::encode(static_cast<uint8_t>(cron_lowest_bit(a.days)));
+    }
+    else
+    {
+        // the day fields are left to the filter, a day matches with the chance of either field
+        double dayChance = 1.0;
+        if(!a.anyDay && !a.anyWeekday)
+            dayChance = 1.0 - (1.0 - cron_count_bits(a.days) / 31.0) * (1.0 - cron_count_bits(a.weekdays) / 7.0);
+        else if(!a.anyDay) dayChance = cron_count_bits(a.days) / 31.0;
+        else if(!a.anyWeekday) dayChance = cron_count_bits(a.weekdays) / 7.0;
+        ratio /= dayChance;
+        if(singleSecond && singleMinute && singleHour) a.rate = ALARM_1_ONCE_PER_DAY;
+        else if(singleSecond && singleMinute)
+        {
+            a.rate = ALARM_1_ONCE_PER_HOUR;
+            ratio *= 24.0 / cron_count_bits(a.hours);
+        }
+        else if(singleSecond)
+        {
+            a.rate = ALARM_1_ONCE_PER_MINUTE;
+            ratio *= 24.0 / cron_count_bits(a.hours) * 60.0 / cron_count_bits(a.minutes);
+        }
+        else
+        {
+            a.rate = ALARM_1_ONCE_PER_SECOND;
+            ratio *= 24.0 / cron_count_bits(a.hours) * 60.0 / cron_count_bits(a.minutes) * 60.0 / cron_count_bits(a.seconds);
+        }
+    }
+
+    uint8_t hourRegister = field_alarm_1_hours_24::encode(h);
+    if(a.clockFormat) hourRegister = field_alarm_1_clock_12hr::encode(FORMAT_0_12) | field_alarm_1_am_pm::encode(h >= 12 ? PM : AM) |
+                                     field_alarm_1_hours_12::encode(h % 12 == 0 ? 12 : h % 12);
+    const uint8_t values[4] = {field_alarm_1_seconds::encode(s), field_alarm_1_minutes::encode(m), hourRegister, dayRegister};
+    for(int i = 0; i < 4; i++)
+        a.registers[i] = (a.rate & (1 << i)) ? MASK_ALARM_MODE : values[i];   // A1M(i+1) masks the register
+
+    a.wakeupsPerFire = ratio;
+    a.filtered = ratio > 1.0;
+    a.rearm    = ratio > CRON_REARM_RATIO;
+}
+
+/**
+ * Compiles a schedule.
+ *
+ * @param expr The schedule, see the top of this file
+ * @param clock_12_hr The format the RTC keeps the time in, the alarm registers are compiled in the same one
+ *
+ * @return the compiled schedule, with valid false if the expression is malformed
+ */
+constexpr cron_alarm_t cron_compile(const char* expr, CLOCK_FORMAT clock_12_hr = FORMAT_0_23)
+{
+    while(*expr == ' ' || *expr == '\t') expr++;
+    if(*expr == '@')
+    {
+        if(cron_starts_with(expr, "@yearly") || cron_starts_with(expr, "@annually")) return cron_compile("0 0 0 1 1 *", clock_12_hr);
+        if(cron_starts_with(expr, "@monthly")) return cron_compile("0 0 0 1 * *", clock_12_hr);
+        if(cron_starts_with(expr, "@weekly"))  return cron_compile("0 0 0 * * 0", clock_12_hr);
+        if(cron_starts_with(expr, "@daily") || cron_starts_with(expr, "@midnight")) return cron_compile("0 0 0 * * *", clock_12_hr);
+        if(cron_starts_with(expr, "@hourly"))  return cron_compile("0 0 * * * *", clock_12_hr);
+        return cron_alarm_t{};
+    }
+
+    int fields = 0;
+    bool inField = false;
+    for(const char* c = expr; *c; c++)
+    {
+        bool blank = (*c == ' ' || *c == '\t');
+        if(!blank && !inField) fields++;
+        inField = !blank;
+    }
+    if(fields != 5 && fields != 6) return cron_alarm_t{};
+
+    cron_alarm_t a;
+    a.clockFormat = clock_12_hr;
+    const char* p = expr;
+    uint64_t bits = 0;
+    bool star = false;
+    if(fields == 6)
+    {
+        if(!cron_parse_field(p, 0, 59, bits, star)) return cron_alarm_t{};
+        a.seconds = bits;
+    }
+    else a.seconds = 1;
+    if(!cron_parse_field(p, 0, 59, bits, star)) return cron_alarm_t{};
+    a.minutes = bits;
+    if(!cron_parse_field(p, 0, 23, bits, star)) return cron_alarm_t{};
+    a.hours = static_cast<uint32_t>(bits);
+    if(!cron_parse_field(p, 1, 31, bits, star)) return cron_alarm_t{};
+    a.days   = static_cast<uint32_t>(bits);
+    a.anyDay = star;
+    if(!cron_parse_field(p, 1, 12, bits, star)) return cron_alarm_t{};
+    a.months = static_cast<uint16_t>(bits);
+    if(!cron_parse_field(p, 0, 7, bits, star)) return cron_alarm_t{};
+    if(bits & 0x80) bits = (bits | 1) & 0x7F;          // 7 is Sunday too
+    a.weekdays   = static_cast<uint8_t>(bits);
+    a.anyWeekday = star;
+
+    a.valid = true;
+    cron_plan(a);
+    return a;
+}
+
+/**
+ * Returns whether the schedule matches the day, by cron's rule for the two day fields.
+ *
+ * @param weekday 0 for Sunday through 6 for Saturday
+ */
+constexpr bool cron_day_matches(const cron_alarm_t& alarm, unsigned day, unsigned weekday)
+{
+    bool date = (alarm.days >> day) & 1;
+    bool dow  = (alarm.weekdays >> weekday) & 1;
+    if(alarm.anyDay && alarm.anyWeekday) return true;
+    if(alarm.anyDay) return dow;
+    if(alarm.anyWeekday) return date;
+    return date || dow;
+}
+
+/**
+ * Returns whether the schedule matches a time, in seconds since the epoch.
+ */
+constexpr bool cron_matches(const cron_alarm_t& alarm, int64_t epoch)
+{
+    if(!alarm.valid) return false;
+    int64_t days = (epoch >= 0 ? epoch : epoch - (SECONDS_PER_DAY - 1)) / SECONDS_PER_DAY;
+    int64_t secondOfDay = epoch - days * SECONDS_PER_DAY;
+    civil_date_t date = civil_from_days(days);
+    return ((alarm.months >> date.month) & 1) &&
+           cron_day_matches(alarm, date.day, weekday_from_days(days) - 1u) &&
+           ((alarm.hours >> (secondOfDay / 3600)) & 1) &&
+           ((alarm.minutes >> (secondOfDay / 60 % 60)) & 1) &&
+           ((alarm.seconds >> (secondOfDay % 60)) & 1);
+}
+
+/**
+ * Returns the first time after now that the schedule matches. The search skips whole months,
+ * days, hours and minutes that cannot match, so it takes a few dozen steps at most per year.
+ *
+ * @param alarm The compiled schedule
+ * @param now Seconds since the epoch
+ *
+ * @return seconds since the epoch, -1 if the schedule is invalid or never matches (e.g. 30/02)
+ */
+constexpr int64_t nextFireTime(const cron_alarm_t& alarm, int64_t now)
+{
+    if(!alarm.valid) return -1;
+    const int64_t limit = now + CRON_MAX_SEARCH_SECONDS;
+    int64_t t = now + 1;
+    while(t <= limit)
+    {
+        int64_t days = (t >= 0 ? t : t - (SECONDS_PER_DAY - 1)) / SECONDS_PER_DAY;
+        int64_t dayStart = days * SECONDS_PER_DAY;
+        unsigned secondOfDay = static_cast<unsigned>(t - dayStart);
+        civil_date_t date = civil_from_days(days);
+        if(!((alarm.months >> date.month) & 1))
+        {
+            t = (date.month == 12 ? days_from_civil(date.year + 1, 1, 1) : days_from_civil(date.year, date.month + 1, 1)) * SECONDS_PER_DAY;
+            continue;
+        }
+        if(!cron_day_matches(alarm, date.day, weekday_from_days(days) - 1u))
+        {
+            t = dayStart + SECONDS_PER_DAY;
+            continue;
+        }
+        unsigned hour = secondOfDay / 3600, minute = secondOfDay / 60 % 60, second = secondOfDay % 60;
+        int nextHour = cron_next_bit(alarm.hours, hour, 24);
+        if(nextHour < 0)
+        {
+            t = dayStart + SECONDS_PER_DAY;
+            continue;
+        }
+        if(static_cast<unsigned>(nextHour) != hour)
+        {
+            t = dayStart + nextHour * 3600;
+            continue;
+        }
+        int nextMinute = cron_next_bit(alarm.minutes, minute, 60);
+        if(nextMinute < 0)
+        {
+            t = dayStart + (hour + 1) * 3600;
+            continue;
+        }
+        if(static_cast<unsigned>(nextMinute) != minute)
+        {
+            t = dayStart + hour * 3600 + nextMinute * 60;
+            continue;
+        }
+        int nextSecond = cron_next_bit(alarm.seconds, second, 60);
+        if(nextSecond < 0)
+        {
+            t = dayStart + hour * 3600 + (minute + 1) * 60;
+            continue;
+        }
+        return dayStart + hour * 3600 + minute * 60 + nextSecond;
+    }
+    return -1;
+}
+
+// Called with the RTC time the schedule fired at
+using cron_callback_t = std::function<void(time_t fired)>;
+
+/**
+ * @class CronAlarm
+ * @brief Runs a compiled schedule on Alarm 1, which it takes over.
+ *
+ * arm() programs the hardware match once, or the next fire time if the schedule re-arms. On each
+ * alarm handleAlarm() calls the callback for the second the alarm went off and re-arms if needed,
+ * so a handler that runs late does not lose the fire: a re-armed alarm went off at the second it
+ * was programmed for, and a hardware match at one of the seconds since the last alarm, up to
+ * CRON_LATE_SECONDS ago, that the schedule matches. attach() makes an AlarmService call
+ * handleAlarm() on Alarm 1.
+ */
+class CronAlarm {
+private:
+    RTC& rtc;
+    cron_alarm_t alarm;
+    cron_callback_t callback;
+    unsigned long wakeups;
+    unsigned long fires;
+    int64_t armed;              // the fire time programmed when re-arming, -1 if none
+    time_t checked;             // the last second tested against the schedule
+
+    void fire(time_t fired);
+    int armFrom(time_t now);
+
+public:
+    CronAlarm(RTC& rtc, const cron_alarm_t& alarm, cron_callback_t callback);
+    int arm();
+    int handleAlarm();
+    void attach(AlarmService& service);
+    const cron_alarm_t& schedule() { return this->alarm; }
+    unsigned long wakeupCount() { return this->wakeups; }
+    unsigned long fireCount() { return this->fires; }
+};
+
+#endif
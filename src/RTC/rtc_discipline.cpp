@@ -0,0 +1,253 @@
+#include <iostream>
+#include <math.h>
+#include <time.h>
+#include <sys/timex.h>
+
+#include "rtc_discipline.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+#define MODEL_TIME_CONSTANT_S   86400.0     // how long the drift model of the RTC remembers
+#define FREQUENCY_SAMPLES       4           // phase errors to fit before the frequency is corrected
+#define MAX_FREQUENCY_PPM       500.0       // the kernel limit of the frequency correction
+#define MAX_SLEW_PPM            500.0       // the rate at which the kernel slews a single shot offset
+#define MAX_OFFSET_ERROR_NS     1000000LL   // measurements less certain than this are not used
+#define TEMPERATURE_WINDOW_S    900.0       // the drift fed to the temperature model is measured over this
+
+static const char* state_name(discipline_state state)
+{
+    switch(state)
+    {
+        case DISCIPLINE_NTP_SYNCED: return "NTP synced";
+        case DISCIPLINE_HOLDOVER:   return "Holdover";
+        default:                    return "Starting";
+    }
+}
+
+/**
+ * Asks the kernel whether NTP is synchronising the system clock: the clock must not be flagged
+ * unsynchronised and the maximum error must be refreshed, which only happens while NTP updates.
+ *
+ * @param ntpMaxErrorUs The largest maximum error for which NTP still counts as available
+ * @param freqPpm Receives the frequency correction currently in the kernel
+ *
+ * @return 1 if NTP is synchronising the clock, 0 if not, -1 if the kernel could not be asked
+ */
+int system_clock_ntp_synchronised(long ntpMaxErrorUs, double& freqPpm)
+{
+    struct timex tx = {};
+    int res = clock_adjtime(CLOCK_REALTIME, &tx);
+    if(res == -1)
+    {
+        cerr << "RTC: Unable to read the state of the system clock" << endl;
+        return -1;
+    }
+    freqPpm = tx.freq / 65536.0;
+    return (res != TIME_ERROR && !(tx.status & STA_UNSYNC) && tx.maxerror < ntpMaxErrorUs) ? 1 : 0;
+}
+
+/**
+ * Creates a discipline that measures the RTC with the detector.
+ *
+ * @param detector The detector to measure the RTC against the system clock with, it must outlive the discipline.
+ * @param strategy EDGE_POLL_SECONDS or EDGE_SQW_GPIO, how the detector finds the seconds rollover.
+ * @param pollSeconds The time between updates in run().
+ * @param dryRun If true the corrections are only reported, the system clock is left alone.
+ * @param ntpMaxErrorUs NTP counts as available while the maximum error the kernel reports stays below this.
+ */
+ClockDiscipline::ClockDiscipline(SecondsEdgeDetector& detector, edge_strategy strategy, int pollSeconds, bool dryRun, long ntpMaxErrorUs)
+    : detector(detector)
+{
+    this->strategy         = strategy;
+    this->pollSeconds      = pollSeconds;
+    this->dryRun           = dryRun;
+    this->ntpMaxErrorUs    = ntpMaxErrorUs;
+    this->state            = DISCIPLINE_STARTING;
+    this->holdoverTargetNs = 0;
+    this->lastUpdateT      = 0;
+    this->appliedSlewNs    = 0;
+    this->temperatureRtc   = NULL;
+    this->temperatureModel = NULL;
+    this->temperatureSum   = 0;
+}
+
+/**
+ * Lets the discipline learn and use the drift of the RTC against its temperature.
+ *
+ * @param rtc The RTC to read the temperature of, the one the detector measures.
+ * @param model The model to feed and predict from, it must outlive the discipline.
+ */
+void ClockDiscipline::setTemperatureModel(RTC& rtc, TemperatureDriftModel& model)
+{
+    this->temperatureRtc   = &rtc;
+    this->temperatureModel = &model;
+    this->temperatureWindow.reset();
+    this->temperatureSum   = 0;
+}
+
+/**
+ * Hands a frequency and a phase correction to the kernel. The frequency replaces the current one,
+ * the phase is slewed at up to 500ppm, the clock is never stepped.
+ *
+ * @param freqPpm The frequency correction, positive makes the system clock faster
+ * @param slewNs The phase correction, positive moves the system clock forward
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int ClockDiscipline::adjustClock(double freqPpm, int64_t slewNs)
+{
+    if(this->dryRun) return 0;
+    struct timex tx = {};
+    tx.modes = ADJ_FREQUENCY;
+    tx.freq  = static_cast<long>(freqPpm * 65536.0);
+    if(clock_adjtime(CLOCK_REALTIME, &tx) == -1)
+    {
+        cerr << "RTC: Unable to set the frequency of the system clock" << endl;
+        return 1;
+    }
+    if(slewNs == 0) return 0;
+    tx = {};
+    tx.modes  = ADJ_OFFSET_SINGLESHOT;  // may not be combined with other modes
+    tx.offset = static_cast<long>(slewNs / 1000);
+    if(clock_adjtime(CLOCK_REALTIME, &tx) == -1)
+    {
+        cerr << "RTC: Unable to slew the system clock" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Measures the RTC against the system clock once and, in holdover, corrects the system clock.
+ * It blocks until the next seconds rollover of the RTC.
+ *
+ * @param status The `discipline_status_t` to fill
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int ClockDiscipline::update(discipline_status_t& status)
+{
+    int64_t offsetNs, errorNs;
+    if(this->detector.measureSystemOffset(offsetNs, errorNs, this->strategy)) return 1;
+    if(errorNs > MAX_OFFSET_ERROR_NS)
+    {
+        cerr << "RTC: Offset measured to only +/- " << errorNs << "ns, not used" << endl;
+        return 1;
+    }
+    double t = monotonic_seconds();
+    double freqPpm;
+    int synced = system_clock_ntp_synchronised(this->ntpMaxErrorUs, freqPpm);
+    if(synced < 0) return 1;
+    int16_t quarters = 0;
+    bool haveTemperature = this->temperatureRtc && !this->temperatureRtc->getTemperatureQuarters(quarters);
+    float temperature = quarters / 4.0f;
+
+    status.offsetNs     = offsetNs;
+    status.errorNs      = errorNs;
+    status.phaseErrorNs = 0;
+    status.slewNs       = 0;
+
+    if(synced)
+    {
+        // the system clock is right, so the offsets trace the drift of the RTC
+        double decay = 1.0;
+        if(this->rtcModel.count()) decay = exp(-(t - this->rtcModel.lastTime()) / MODEL_TIME_CONSTANT_S);
+        this->rtcModel.add(t, static_cast<double>(offsetNs), decay);
+        if(this->state != DISCIPLINE_NTP_SYNCED)
+        {
+            this->temperatureWindow.reset();
+            this->temperatureSum = 0;
+        }
+        this->state = DISCIPLINE_NTP_SYNCED;
+
+        if(this->temperatureModel && haveTemperature)
+        {
+            this->temperatureWindow.add(t, static_cast<double>(offsetNs));
+            this->temperatureSum += temperature;
+            if(this->temperatureWindow.span() >= TEMPERATURE_WINDOW_S)
+            {
+                this->temperatureModel->add(static_cast<float>(this->temperatureSum / this->temperatureWindow.count()),
+                                            this->temperatureWindow.slope() * 1e-3);
+                this->temperatureModel->fit();
+                this->temperatureWindow.reset();
+                this->temperatureSum = 0;
+            }
+        }
+    }
+    else
+    {
+        if(this->state != DISCIPLINE_HOLDOVER)
+        {
+            this->phaseError.reset();
+            this->appliedSlewNs    = 0;
+            this->holdoverTargetNs = this->rtcModel.count() ? this->rtcModel.valueAt(t) : static_cast<double>(offsetNs);
+            this->lastUpdateT      = t;
+            this->state            = DISCIPLINE_HOLDOVER;
+        }
+        // where the offset should be if the system clock kept NTP time: the RTC drifts on from there
+        double driftPpm = this->rtcModel.slope() * 1e-3;
+        double temperatureDriftPpm;
+        if(haveTemperature && !this->temperatureModel->predictDriftPpm(temperature, temperatureDriftPpm))
+            driftPpm = temperatureDriftPpm;
+        this->holdoverTargetNs += driftPpm * 1e3 * (t - this->lastUpdateT);    // ppm to ns per second
+        this->lastUpdateT = t;
+        int64_t phaseNs = offsetNs - static_cast<int64_t>(this->holdoverTargetNs);
+        status.phaseErrorNs = phaseNs;
+
+        // with the slews added back the phase error only moves with the frequency error
+        this->phaseError.add(t, static_cast<double>(phaseNs + this->appliedSlewNs));
+        if(this->phaseError.count() >= FREQUENCY_SAMPLES)
+        {
+            freqPpm += this->phaseError.slope() * 1e-3;     // ns per second to ppm
+            if(freqPpm > MAX_FREQUENCY_PPM) freqPpm = MAX_FREQUENCY_PPM;
+            if(freqPpm < -MAX_FREQUENCY_PPM) freqPpm = -MAX_FREQUENCY_PPM;
+            this->phaseError.reset();
+            this->appliedSlewNs = 0;
+        }
+
+        // slew no more than the kernel gets through before the next update
+        int64_t maxSlewNs = static_cast<int64_t>(MAX_SLEW_PPM * 1e-6 * NS_PER_SECOND * this->pollSeconds / 2);
+        int64_t slewNs = 0;
+        if(phaseNs > errorNs || phaseNs < -errorNs)
+            slewNs = phaseNs > maxSlewNs ? maxSlewNs : (phaseNs < -maxSlewNs ? -maxSlewNs : phaseNs);
+        if(this->adjustClock(freqPpm, slewNs)) return 1;
+        if(!this->dryRun) this->appliedSlewNs += slewNs;
+        status.slewNs = slewNs;
+    }
+    status.state   = this->state;
+    status.rtcPpm  = this->rtcModel.slope() * 1e-3;
+    status.freqPpm = freqPpm;
+    return 0;
+}
+
+/**
+ * Runs the discipline as a daemon, one update every pollSeconds until `running` is cleared,
+ * e.g. by a signal handler. A failed update is reported and the next one is tried as usual.
+ *
+ * @param running The loop stops when this becomes false
+ *
+ * @return 0 when stopped, 1 if the wait for the next update failed
+ */
+int ClockDiscipline::run(volatile bool& running)
+{
+    discipline_status_t status;
+    int64_t next = monotonic_ns();
+    while(running)
+    {
+        if(this->update(status)) cerr << "RTC: Discipline update failed" << endl;
+        else
+        {
+            cout << state_name(status.state) << ": RTC - system " << status.offsetNs << "ns +/- " << status.errorNs
+                 << "ns, phase error " << status.phaseErrorNs << "ns, slew " << status.slewNs << "ns, RTC "
+                 << status.rtcPpm << "ppm, frequency " << status.freqPpm << "ppm" << endl;
+        }
+        next += static_cast<int64_t>(this->pollSeconds) * NS_PER_SECOND;
+        if(sleep_until_ns(CLOCK_MONOTONIC, next, &running) && running)
+        {
+            cerr << "RTC: Unable to wait for the next discipline update" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef RTC_DISCIPLINE_H_
+#define RTC_DISCIPLINE_H_
+
+#include "rtc_edge.h"
+#include "linear_fit.h"
+#include "rtc_tempco.h"
+#include <stdint.h>
+
+// What the discipline is doing with the system clock
+enum discipline_state
+{
+    DISCIPLINE_STARTING,    // no measurement yet
+    DISCIPLINE_NTP_SYNCED,  // NTP steers the system clock, the drift of the RTC is learned
+    DISCIPLINE_HOLDOVER     // no NTP, the system clock is steered to the RTC corrected by the model
+};
+
+// typedef struct to report one update of the discipline
+typedef struct discipline_status_t {
+    discipline_state state;
+    int64_t offsetNs;       // RTC minus system clock as measured
+    int64_t errorNs;        // the bound on the error of offsetNs
+    int64_t phaseErrorNs;   // in holdover, how far the system clock is behind the corrected RTC
+    double rtcPpm;          // learned rate of the RTC against NTP, positive if the RTC runs fast
+    double freqPpm;         // frequency correction of the system clock in the kernel
+    int64_t slewNs;         // phase correction handed to the kernel in this update
+} discipline_status_t;
+
+int system_clock_ntp_synchronised(long ntpMaxErrorUs, double& freqPpm);
+
+/**
+ * @class ClockDiscipline
+ * @brief Keeps the system clock aligned to the DS3231 without ever stepping it.
+ *
+ * Every update measures the offset between the RTC and CLOCK_REALTIME at a seconds rollover.
+ * While the kernel reports that NTP is synchronising the clock, the offsets are only fitted to a
+ * line, whose slope is the drift of the RTC. When NTP goes away the discipline enters holdover:
+ * the target is that line extrapolated, i.e. the RTC corrected for its learned drift, and the
+ * system clock is steered to it with clock_adjtime(), the frequency from the slope of the phase
+ * error and the phase with a bounded slew (ADJ_OFFSET_SINGLESHOT). NTP coming back ends holdover
+ * and hands the clock back untouched.
+ *
+ * With a TemperatureDriftModel the discipline also feeds the model with the drift measured over
+ * every 15 minutes of NTP time and the mean temperature over them, and in holdover it advances the
+ * target with the drift predicted for the current temperature instead of the average drift.
+ *
+ * Adjusting the clock needs CAP_SYS_TIME; with dryRun the corrections are only reported.
+ */
+class ClockDiscipline {
+private:
+    SecondsEdgeDetector& detector;
+    edge_strategy strategy;
+    int pollSeconds;
+    bool dryRun;
+    long ntpMaxErrorUs;
+    discipline_state state;
+    LinearFit rtcModel;         // RTC minus system clock against CLOCK_MONOTONIC while NTP is synced
+    LinearFit phaseError;       // holdover phase error with the applied slews added back
+    double holdoverTargetNs;    // where the offset should be in holdover, advanced by the drift
+    double lastUpdateT;         // CLOCK_MONOTONIC of the last holdover update in s
+    int64_t appliedSlewNs;      // slews applied since phaseError was last reset
+    RTC* temperatureRtc;
+    TemperatureDriftModel* temperatureModel;
+    LinearFit temperatureWindow;    // RTC minus system clock over the current temperature window
+    double temperatureSum;          // sum of the temperatures read in that window
+
+    int adjustClock(double freqPpm, int64_t slewNs);
+
+public:
+    ClockDiscipline(SecondsEdgeDetector& detector, edge_strategy strategy = EDGE_POLL_SECONDS, int pollSeconds = 16,
+                    bool dryRun = false, long ntpMaxErrorUs = 500000);
+    int update(discipline_status_t& status);
+    int run(volatile bool& running);
+    void setTemperatureModel(RTC& rtc, TemperatureDriftModel& model);
+    discipline_state getState() { return this->state; }
+    double getRtcPpm() { return this->rtcModel.slope() * 1e-3; }
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include <iostream>
+#include <time.h>
+#include <system_error>
+#include <gpiod.hpp>
+
+#include "rtc_edge.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+#define COARSE_POLL_NS      5000000LL       // spacing of the reads that locate the rollover
+#define FINE_WINDOW_NS      10000000LL      // how early the back to back reads start
+
+/**
+ * Creates a detector that can only use EDGE_POLL_SECONDS.
+ *
+ * @param rtc The RTC to observe, it must outlive the detector.
+ */
+SecondsEdgeDetector::SecondsEdgeDetector(RTC& rtc) : rtc(rtc), gpioLine(0), gpioLatencyNs(0)
+{
+}
+
+/**
+ * Creates a detector that can also use EDGE_SQW_GPIO.
+ *
+ * @param rtc The RTC to observe, it must outlive the detector.
+ * @param gpioChip The GPIO chip the INT/SQW pin is connected to, e.g. "gpiochip0" ("gpiochip4" on a Pi 5).
+ * @param gpioLine The line offset of the INT/SQW pin on that chip.
+ * @param gpioLatencyNs The bound on the delay between the edge and its kernel timestamp.
+ */
+SecondsEdgeDetector::SecondsEdgeDetector(RTC& rtc, const std::string& gpioChip, unsigned int gpioLine, int64_t gpioLatencyNs)
+    : rtc(rtc), gpioChip(gpioChip), gpioLine(gpioLine), gpioLatencyNs(gpioLatencyNs)
+{
+}
+
+/**
+ * Finds the next seconds rollover of the RTC. It blocks for up to two seconds.
+ *
+ * @param edge The `rtc_edge_t` to fill
+ * @param strategy EDGE_POLL_SECONDS or EDGE_SQW_GPIO
+ * @param timeoutMs How long to wait for the rollover before giving up
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int SecondsEdgeDetector::findEdge(rtc_edge_t& edge, edge_strategy strategy, int timeoutMs)
+{
+    int res = (strategy == EDGE_SQW_GPIO) ? this->sqwEdge(edge, timeoutMs) : this->pollEdge(edge, timeoutMs);
+    if(res) return res;
+    // read the second that has just started, well within that second
+    if(this->rtc.getTime(edge.time) || this->rtc.getEpoch(edge.epoch)) return 1;
+    edge.phase_ns = edge.edge_ns % NS_PER_SECOND;
+    return 0;
+}
+
+/**
+ * Measures how far the RTC is ahead of the system clock: the RTC time at a seconds rollover minus
+ * CLOCK_REALTIME at the same instant. The rollover is found on CLOCK_MONOTONIC and carried over to
+ * CLOCK_REALTIME with a pair of monotonic readings around a realtime one.
+ *
+ * @param offsetNs Receives the offset, positive if the RTC is ahead of the system clock
+ * @param errorNs Receives the bound on the error of the offset
+ * @param strategy EDGE_POLL_SECONDS or EDGE_SQW_GPIO
+ * @param timeoutMs How long to wait for the rollover before giving up
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int SecondsEdgeDetector::measureSystemOffset(int64_t& offsetNs, int64_t& errorNs, edge_strategy strategy, int timeoutMs)
+{
+    rtc_edge_t edge;
+    if(this->findEdge(edge, strategy, timeoutMs)) return 1;
+
+    struct timespec realtime;
+    int64_t before = monotonic_ns();
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    int64_t after = monotonic_ns();
+    int64_t realtimeNs = static_cast<int64_t>(realtime.tv_sec) * NS_PER_SECOND + realtime.tv_nsec;
+    int64_t monotonicToRealtime = realtimeNs - (before + after) / 2;
+
+    offsetNs = static_cast<int64_t>(edge.epoch) * NS_PER_SECOND - (edge.edge_ns + monotonicToRealtime);
+    errorNs  = edge.error_ns + (after - before) / 2;
+    return 0;
+}
+
+/**
+ * Sets the RTC to the system time at a second boundary with RTC::setCurrentTimeToRTCAligned() and
+ * verifies it: the residual offset is measured at the next rollover and has to be within the limit.
+ *
+ * @param offsetNs Receives the residual offset, positive if the RTC is ahead of the system clock
+ * @param errorNs Receives the bound on the error of the offset
+ * @param clock_12_hr FORMAT_0_12 or FORMAT_0_23 for the hours register
+ * @param leadNs How much earlier than the boundary to start the write, see setCurrentTimeToRTCAligned()
+ * @param maxOffsetNs The limit on the residual offset plus its error bound
+ * @param strategy EDGE_POLL_SECONDS or EDGE_SQW_GPIO, how the residual is measured
+ *
+ * @return 0 if the time was set within the limit, 1 if unsuccessful or the residual is beyond it
+ */
+int SecondsEdgeDetector::setTimeAligned(int64_t& offsetNs, int64_t& errorNs, CLOCK_FORMAT clock_12_hr, int64_t leadNs,
+                                        int64_t maxOffsetNs, edge_strategy strategy)
+{
+    if(this->rtc.setCurrentTimeToRTCAligned(clock_12_hr, leadNs)) return 1;
+    if(this->measureSystemOffset(offsetNs, errorNs, strategy))
+    {
+        cerr << "RTC: Unable to verify the time that was set" << endl;
+        return 1;
+    }
+    if((offsetNs < 0 ? -offsetNs : offsetNs) + errorNs > maxOffsetNs)
+    {
+        cerr << "RTC: The time was set " << offsetNs << "ns +/- " << errorNs << "ns off the system clock" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Locates the rollover with reads COARSE_POLL_NS apart, then sleeps until FINE_WINDOW_NS before the
+ * following rollover and reads the seconds register back to back. The rollover lies between the
+ * start of the last read that returned the old value and the end of the first one with the new value.
+ */
+int SecondsEdgeDetector::pollEdge(rtc_edge_t& edge, int timeoutMs)
+{
+    int64_t deadline = monotonic_ns() + static_cast<int64_t>(timeoutMs) * 1000000LL;
+    uint8_t first, value, previous;
+    if(this->rtc.getSeconds(first)) return 1;
+
+    // coarse: find the rollover to within COARSE_POLL_NS
+    int64_t coarse;
+    do
+    {
+        sleep_until_ns(CLOCK_MONOTONIC, monotonic_ns() + COARSE_POLL_NS);
+        if(this->rtc.getSeconds(value)) return 1;
+        coarse = monotonic_ns();
+    } while(value == first && coarse < deadline);
+
+    // fine: read back to back across the following rollover
+    if(value != first)
+    {
+        sleep_until_ns(CLOCK_MONOTONIC, coarse + NS_PER_SECOND - COARSE_POLL_NS - FINE_WINDOW_NS);
+        int64_t previousStart = monotonic_ns();
+        if(this->rtc.getSeconds(previous)) return 1;
+        for(int64_t start = monotonic_ns(); start < deadline; start = monotonic_ns())
+        {
+            if(this->rtc.getSeconds(value)) return 1;
+            int64_t end = monotonic_ns();
+            if(value != previous)
+            {
+                edge.edge_ns  = (previousStart + end) / 2;
+                edge.error_ns = (end - previousStart) / 2;
+                return 0;
+            }
+            previousStart = start;
+        }
+    }
+    cerr << "RTC: No seconds rollover seen within " << timeoutMs << "ms" << endl;
+    return 1;
+}
+
+/**
+ * Waits for a falling edge of the 1Hz square wave on the GPIO line and takes its kernel timestamp,
+ * which is on CLOCK_MONOTONIC for kernels from 5.7 on.
+ */
+int SecondsEdgeDetector::sqwEdge(rtc_edge_t& edge, int timeoutMs)
+{
+    if(this->gpioChip.empty())
+    {
+        cerr << "RTC: No GPIO line configured for the square wave" << endl;
+        return 1;
+    }
+    try
+    {
+        gpiod::chip chip(this->gpioChip);
+        gpiod::line line = chip.get_line(this->gpioLine);
+        line.request({"ds3231-edge", gpiod::line_request::EVENT_FALLING_EDGE, 0});
+        if(!line.event_wait(chrono::milliseconds(timeoutMs)))
+        {
+            line.release();
+            cerr << "RTC: No square wave edge seen within " << timeoutMs << "ms" << endl;
+            return 1;
+        }
+        gpiod::line_event event = line.event_read();
+        line.release();
+        edge.edge_ns  = event.timestamp.count() - this->gpioLatencyNs / 2;
+        edge.error_ns = this->gpioLatencyNs / 2;
+    }
+    catch(const system_error& e)
+    {
+        cerr << "RTC: Unable to watch the square wave: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
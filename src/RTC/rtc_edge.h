@@ -0,0 +1,57 @@
+#ifndef RTC_EDGE_H_
+#define RTC_EDGE_H_
+
+#include "rtc.h"
+#include <stdint.h>
+#include <string>
+
+// The largest residual offset, plus its error bound, that setTimeAligned() accepts
+#define ALIGNED_MAX_OFFSET_NS   5000000LL
+
+// How the seconds rollover of the RTC is observed
+enum edge_strategy
+{
+    EDGE_POLL_SECONDS,      // read REG_TIME_SECONDS in a tight loop around the expected rollover
+    EDGE_SQW_GPIO           // falling edge of the 1Hz square wave on a GPIO line, through libgpiod
+};
+
+// typedef struct to store where a seconds rollover of the RTC lies on CLOCK_MONOTONIC
+typedef struct rtc_edge_t {
+    int64_t edge_ns;        // CLOCK_MONOTONIC of the rollover
+    int64_t error_ns;       // the rollover lies within edge_ns +/- error_ns
+    int64_t phase_ns;       // edge_ns modulo one second, the phase of the RTC second on CLOCK_MONOTONIC
+    user_time_t time;       // the RTC time that started at the rollover
+    time_t epoch;           // the same time as seconds since the epoch, with the century bit
+} rtc_edge_t;
+
+/**
+ * @class SecondsEdgeDetector
+ * @brief Finds the CLOCK_MONOTONIC instant at which the seconds register of the RTC increments,
+ * which turns the whole second readings of the DS3231 into a sub-millisecond time reference.
+ *
+ * EDGE_POLL_SECONDS needs nothing but the bus: it polls coarsely to locate the rollover, sleeps
+ * until just before the next one and then reads the seconds register back to back, so the error
+ * is one seconds register transaction. EDGE_SQW_GPIO uses the falling edge of the 1Hz square wave,
+ * which coincides with the seconds increment, timestamped by the kernel on the GPIO line connected
+ * to INT/SQW. The square wave must have been enabled with enableSquareWave(SQW_1HZ).
+ */
+class SecondsEdgeDetector {
+private:
+    RTC& rtc;
+    std::string gpioChip;
+    unsigned int gpioLine;
+    int64_t gpioLatencyNs;
+
+    int pollEdge(rtc_edge_t& edge, int timeoutMs);
+    int sqwEdge(rtc_edge_t& edge, int timeoutMs);
+
+public:
+    SecondsEdgeDetector(RTC& rtc);
+    SecondsEdgeDetector(RTC& rtc, const std::string& gpioChip, unsigned int gpioLine, int64_t gpioLatencyNs = 50000);
+    int findEdge(rtc_edge_t& edge, edge_strategy strategy = EDGE_POLL_SECONDS, int timeoutMs = 3000);
+    int measureSystemOffset(int64_t& offsetNs, int64_t& errorNs, edge_strategy strategy = EDGE_POLL_SECONDS, int timeoutMs = 3000);
+    int setTimeAligned(int64_t& offsetNs, int64_t& errorNs, CLOCK_FORMAT clock_12_hr = FORMAT_0_23, int64_t leadNs = 0,
+                       int64_t maxOffsetNs = ALIGNED_MAX_OFFSET_NS, edge_strategy strategy = EDGE_POLL_SECONDS);
+};
+
+#endif
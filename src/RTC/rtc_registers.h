@@ -0,0 +1,235 @@
+#ifndef RTC_REGISTERS_H_
+#define RTC_REGISTERS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+#include "rtc.h"
+#include "bcd.h"
+
+/*
+ * Typed map of the DS3231 register file.
+ *
+ * A field is a type that names a register, the bits of it the field occupies, the type of its value
+ * and how the bits are encoded. Everything is a template constant, so get() is a load, an and and a
+ * shift (plus one table lookup for BCD) and set() is an and and an or, the same instructions as the
+ * hand written masks, and a set() of a constant value folds into a constant. The REG_* and MASK_*
+ * macros of rtc.h stay for the callers that use them, the fields are built from them.
+ *
+ * get() and set() take the register file indexed by address. A block read from further up, e.g.
+ * the Alarm 1 registers from 0x07, is passed with the address of its first register:
+ *
+ *     uint8_t hours = field_alarm_1_hours_24::get(alarm_1_regs, REG_SECONDS_ALARM_1);
+ *
+ * rtc_bits<> gathers one bit fields spread over several registers into one value, e.g. the A1Mx
+ * bits into the rate of Alarm 1. rtc_burst<> encodes or decodes a list of fields over the block of
+ * registers from the lowest to the highest of them, for writing or reading it in one transaction;
+ * with constant values the whole block is a constant.
+ */
+
+enum rtc_encoding
+{
+    ENC_RAW,    // the bits as they are
+    ENC_BCD     // two BCD digits, the value is decimal
+};
+
+/**
+ * Returns the position of the lowest set bit of a mask, which must not be 0.
+ */
+constexpr unsigned rtc_mask_shift(uint8_t mask)
+{
+    unsigned shift = 0;
+    while(!(mask & (1u << shift))) shift++;
+    return shift;
+}
+
+template<uint8_t Reg, uint8_t Mask, typename T = uint8_t, rtc_encoding Enc = ENC_RAW>
+struct rtc_field {
+    static_assert(Mask != 0, "a field has at least one bit");
+    static_assert(Reg < DS3231_NUM_REGISTERS, "the DS3231 has registers 0x00 through 0x12");
+
+    typedef T value_type;
+    static constexpr uint8_t reg = Reg;
+    static constexpr uint8_t mask = Mask;
+    static constexpr unsigned shift = rtc_mask_shift(Mask);
+
+    // the value of the field in a register value
+    static constexpr T decode(uint8_t value)
+    {
+        uint8_t bits = static_cast<uint8_t>((value & Mask) >> shift);
+        if constexpr(Enc == ENC_BCD) bits = bcd_to_decimal(bits);
+        return static_cast<T>(bits);
+    }
+
+    // the bits of the field for a value, every other bit is 0
+    static constexpr uint8_t encode(T field)
+    {
+        uint8_t bits = static_cast<uint8_t>(field);
+        if constexpr(Enc == ENC_BCD) bits = decimal_to_bcd(bits);
+        return static_cast<uint8_t>((bits << shift) & Mask);
+    }
+
+    // a register value with the field replaced
+    static constexpr uint8_t update(uint8_t value, T field)
+    {
+        return static_cast<uint8_t>((value & ~Mask) | encode(field));
+    }
+
+    static constexpr T get(const uint8_t* regs, uint8_t first = 0) { return decode(regs[Reg - first]); }
+    static constexpr void set(uint8_t* regs, T field, uint8_t first = 0) { regs[Reg - first] = update(regs[Reg - first], field); }
+};
+
+/**
+ * One bit fields gathered into one value, the first field is bit 0.
+ */
+template<typename T, typename... Fields>
+struct rtc_bits {
+    static_assert((((Fields::mask & (Fields::mask - 1)) == 0) && ...), "rtc_bits takes one bit fields");
+
+    typedef T value_type;
+
+    static constexpr T get(const uint8_t* regs, uint8_t first = 0)
+    {
+        unsigned value = 0, bit = 0;
+        ((value |= static_cast<unsigned>((regs[Fields::reg - first] & Fields::mask) != 0) << bit++), ...);
+        return static_cast<T>(value);
+    }
+
+    static constexpr void set(uint8_t* regs, T field, uint8_t first = 0)
+    {
+        unsigned bit = 0;
+        ((Fields::set(regs, (static_cast<unsigned>(field) >> bit++) & 1, first)), ...);
+    }
+};
+
+/**
+ * Keeps the run of set bits from the top bit of a `width` bit value down to the first clear one,
+ * e.g. 0b1101 becomes 0b1100. The rate of an alarm is its mask bits read this way.
+ */
+constexpr uint8_t rtc_leading_ones(uint8_t bits, unsigned width)
+{
+    uint8_t run = bits & (1u << (width - 1));
+    for(unsigned i = 1; i < width; i++) run |= bits & (run >> 1);
+    return run;
+}
+
+/**
+ * A list of fields encoded and decoded over one block of registers, from the lowest register of
+ * the fields to the highest. The fields must not share bits.
+ */
+template<typename... Fields>
+struct rtc_burst {
+    static constexpr uint8_t first = std::min({Fields::reg...});
+    static constexpr uint8_t last  = std::max({Fields::reg...});
+    static constexpr size_t size   = last - first + 1;
+
+    typedef std::array<uint8_t, size> block_t;
+    typedef std::tuple<typename Fields::value_type...> values_t;
+
+    static constexpr bool disjoint()
+    {
+        const uint8_t regs[]  = {Fields::reg...};
+        const uint8_t masks[] = {Fields::mask...};
+        for(size_t i = 0; i < sizeof...(Fields); i++)
+            for(size_t j = i + 1; j < sizeof...(Fields); j++)
+                if(regs[i] == regs[j] && (masks[i] & masks[j])) return false;
+        return true;
+    }
+    static_assert(disjoint(), "the fields of a burst share bits");
+
+    // the bits of register first + i that belong to the fields
+    static constexpr uint8_t mask(size_t i)
+    {
+        return static_cast<uint8_t>((0 | ... | (Fields::reg == first + i ? Fields::mask : 0)));
+    }
+
+    // the block with the fields set to the values and every other bit 0
+    static constexpr block_t encode(typename Fields::value_type... values)
+    {
+        block_t block = {};
+        ((block[Fields::reg - first] |= Fields::encode(values)), ...);
+        return block;
+    }
+
+    // sets the fields in a block read before, the other bits are kept
+    static constexpr void encode(uint8_t* block, typename Fields::value_type... values)
+    {
+        ((block[Fields::reg - first] = Fields::update(block[Fields::reg - first], values)), ...);
+    }
+
+    static constexpr values_t decode(const uint8_t* block)
+    {
+        return values_t(Fields::decode(block[Fields::reg - first])...);
+    }
+};
+
+// 0x00 - 0x06: time, the hours are 1-12 with the PM bit when the 12 hour bit is set, 0-23 otherwise
+typedef rtc_field<REG_TIME_SECONDS,       0x7F, uint8_t, ENC_BCD>       field_time_seconds;
+typedef rtc_field<REG_TIME_MINUTES,       0x7F, uint8_t, ENC_BCD>       field_time_minutes;
+typedef rtc_field<REG_TIME_HOURS,         0x40, CLOCK_FORMAT>           field_time_clock_12hr;
+typedef rtc_field<REG_TIME_HOURS,         0x20, AM_OR_PM>               field_time_am_pm;
+typedef rtc_field<REG_TIME_HOURS,         0x1F, uint8_t, ENC_BCD>       field_time_hours_12;
+typedef rtc_field<REG_TIME_HOURS,         0x3F, uint8_t, ENC_BCD>       field_time_hours_24;
+typedef rtc_field<REG_TIME_DAY_OF_WEEK,   0x07>                         field_time_day_of_week;
+typedef rtc_field<REG_TIME_DATE_OF_MONTH, 0x3F, uint8_t, ENC_BCD>       field_time_date_of_month;
+typedef rtc_field<REG_TIME_MONTH,         0x80, bool>                   field_time_century;
+typedef rtc_field<REG_TIME_MONTH,         0x1F, uint8_t, ENC_BCD>       field_time_month;
+typedef rtc_field<REG_TIME_YEAR,          0xFF, uint8_t, ENC_BCD>       field_time_year;
+
+// 0x07 - 0x0A: Alarm 1, AxMx is the mask bit of each register
+typedef rtc_field<REG_SECONDS_ALARM_1,    MASK_ALARM_MODE, bool>                    field_alarm_1_a1m1;
+typedef rtc_field<REG_SECONDS_ALARM_1,    MASK_ALARM_SECONDS, uint8_t, ENC_BCD>     field_alarm_1_seconds;
+typedef rtc_field<REG_MINUTES_ALARM_1,    MASK_ALARM_MODE, bool>                    field_alarm_1_a1m2;
+typedef rtc_field<REG_MINUTES_ALARM_1,    MASK_ALARM_MINUTES, uint8_t, ENC_BCD>     field_alarm_1_minutes;
+typedef rtc_field<REG_HOURS_ALARM_1,      MASK_ALARM_MODE, bool>                    field_alarm_1_a1m3;
+typedef rtc_field<REG_HOURS_ALARM_1,      0x40, CLOCK_FORMAT>                       field_alarm_1_clock_12hr;
+typedef rtc_field<REG_HOURS_ALARM_1,      0x20, AM_OR_PM>                           field_alarm_1_am_pm;
+typedef rtc_field<REG_HOURS_ALARM_1,      MASK_ALARM_HOURS, uint8_t, ENC_BCD>       field_alarm_1_hours_12;
+typedef rtc_field<REG_HOURS_ALARM_1,      0x3F, uint8_t, ENC_BCD>                   field_alarm_1_hours_24;
+typedef rtc_field<REG_DAYS_ALARM_1,       MASK_ALARM_MODE, bool>                    field_alarm_1_a1m4;
+typedef rtc_field<REG_DAYS_ALARM_1,       MASK_ALARM_DAY_OR_DATEINV, DAY_OR_DATE>   field_alarm_1_day_or_date;
+typedef rtc_field<REG_DAYS_ALARM_1,       MASK_ALARM_DAY_DATE, uint8_t, ENC_BCD>    field_alarm_1_day_date;
+typedef rtc_bits<uint8_t, field_alarm_1_a1m1, field_alarm_1_a1m2, field_alarm_1_a1m3, field_alarm_1_a1m4> field_alarm_1_mask_bits;
+
+// 0x0B - 0x0D: Alarm 2
+typedef rtc_field<REG_MINUTES_ALARM_2,    MASK_ALARM_MODE, bool>                    field_alarm_2_a2m2;
+typedef rtc_field<REG_MINUTES_ALARM_2,    MASK_ALARM_MINUTES, uint8_t, ENC_BCD>     field_alarm_2_minutes;
+typedef rtc_field<REG_HOURS_ALARM_2,      MASK_ALARM_MODE, bool>                    field_alarm_2_a2m3;
+typedef rtc_field<REG_HOURS_ALARM_2,      0x40, CLOCK_FORMAT>                       field_alarm_2_clock_12hr;
+typedef rtc_field<REG_HOURS_ALARM_2,      0x20, AM_OR_PM>                           field_alarm_2_am_pm;
+typedef rtc_field<REG_HOURS_ALARM_2,      MASK_ALARM_HOURS, uint8_t, ENC_BCD>       field_alarm_2_hours_12;
+typedef rtc_field<REG_HOURS_ALARM_2,      0x3F, uint8_t, ENC_BCD>                   field_alarm_2_hours_24;
+typedef rtc_field<REG_DAYS_ALARM_2,       MASK_ALARM_MODE, bool>                    field_alarm_2_a2m4;
+typedef rtc_field<REG_DAYS_ALARM_2,       MASK_ALARM_DAY_OR_DATEINV, DAY_OR_DATE>   field_alarm_2_day_or_date;
+typedef rtc_field<REG_DAYS_ALARM_2,       MASK_ALARM_DAY_DATE, uint8_t, ENC_BCD>    field_alarm_2_day_date;
+typedef rtc_bits<uint8_t, field_alarm_2_a2m2, field_alarm_2_a2m3, field_alarm_2_a2m4> field_alarm_2_mask_bits;
+
+// 0x0E: control
+typedef rtc_field<REG_CONTROL, MASK_ENABLE_OSCILLATOR_INV, bool>                       field_control_oscillator_disabled;
+typedef rtc_field<REG_CONTROL, MASK_BAT_BACKUP_SQW_ENABLE, bool>                       field_control_battery_backed_sqw;
+typedef rtc_field<REG_CONTROL, MASK_CONV_TEMPERATURE, bool>                            field_control_convert_temperature;
+typedef rtc_field<REG_CONTROL, MASK_RATE_SELECT_2 | MASK_RATE_SELECT_1, sqw_frequency> field_control_sqw_rate;
+typedef rtc_field<REG_CONTROL, MASK_INTERRUPT_CONTROL, bool>                           field_control_interrupt_control;
+typedef rtc_field<REG_CONTROL, MASK_ALARM_2_INT_ENABLE, bool>                          field_control_alarm_2_int_enabled;
+typedef rtc_field<REG_CONTROL, MASK_ALARM_1_INT_ENABLE, bool>                          field_control_alarm_1_int_enabled;
+
+// every bit of 0x0E but CONV, which is never written
+typedef rtc_burst<field_control_oscillator_disabled, field_control_battery_backed_sqw, field_control_sqw_rate,
+                  field_control_interrupt_control, field_control_alarm_2_int_enabled, field_control_alarm_1_int_enabled> burst_control;
+
+// 0x0F: status, the flags are write-0-to-clear
+typedef rtc_field<REG_STATUS, MASK_OSCILLATOR_STOP_FLAG, bool>   field_status_oscillator_stopped;
+typedef rtc_field<REG_STATUS, MASK_ENABLE_32KHZ_OUT, bool>       field_status_enable_32kHz;
+typedef rtc_field<REG_STATUS, MASK_BUSY, bool>                   field_status_busy;
+typedef rtc_field<REG_STATUS, MASK_ALARM_2_FLAG, bool>           field_status_alarm_2_flag;
+typedef rtc_field<REG_STATUS, MASK_ALARM_1_FLAG, bool>           field_status_alarm_1_flag;
+
+// 0x10 - 0x12: aging offset and temperature, both two's complement
+typedef rtc_field<REG_AGING_OFFSET,    0xFF, int8_t>     field_aging_offset;
+typedef rtc_field<REG_TEMPERATURE_MSB, 0xFF, int8_t>     field_temperature_integer;
+typedef rtc_field<REG_TEMPERATURE_LSB, 0xC0>             field_temperature_quarters;
+
+#endif
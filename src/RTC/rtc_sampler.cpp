@@ -0,0 +1,226 @@
+#include <iostream>
+#include <math.h>
+#include <time.h>
+
+#include "rtc_sampler.h"
+#include "rtc_time.h"
+
+using namespace std;
+
+#define NS_PER_MS               1000000LL
+#define CONVERSION_PERIOD_NS    64000000000LL   // the TCXO converts every 64 seconds
+#define CONVERSION_MAX_NS       200000000LL     // tCONV at most, BSY stays set this long
+#define EXPIRY_MARGIN_NS        5000000LL       // read this long after the latest possible end
+#define REFINE_WIDTH_NS         100000000LL     // a wider interval is narrowed by reading at its start
+#define LEARN_POLL_NS           100000000LL     // shorter than a conversion, so BSY cannot be missed
+#define BUSY_POLL_NS            5000000LL       // spacing of the reads while BSY is set
+
+/**
+ * Creates a sampler. Nothing is read until the first get() or learnPhase().
+ *
+ * @param rtc The RTC to read, it must outlive the sampler.
+ * @param maxDriftPpm The largest rate difference expected between the RTC and CLOCK_MONOTONIC.
+ * @param unknownTtlMs How long readings are cached while the conversion phase is not known.
+ */
+TemperatureSampler::TemperatureSampler(RTC& rtc, double maxDriftPpm, int unknownTtlMs) : rtc(rtc)
+{
+    this->maxDriftPpm      = maxDriftPpm;
+    this->unknownTtlMs     = unknownTtlMs;
+    this->phaseKnown       = false;
+    this->endLowNs         = 0;
+    this->endHighNs        = 0;
+    this->cacheValid       = false;
+    this->cachedQuarters   = 0;
+    this->lastReadNs       = 0;
+    this->expiresNs        = 0;
+    this->reads            = 0;
+    this->deadbandQuarters = 0;
+    this->notified         = false;
+    this->notifiedQuarters = 0;
+}
+
+/**
+ * Reads the temperature and BSY from the bus in one transaction.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int TemperatureSampler::read(int64_t& nowNs, int16_t& quarters, bool& busy)
+{
+    int64_t start = monotonic_ns();
+    if(this->rtc.getTemperatureQuarters(quarters, busy)) return 1;
+    nowNs = (start + monotonic_ns()) / 2;
+    this->reads++;
+    return 0;
+}
+
+/**
+ * Narrows the phase with an observation that a conversion ended between lowNs and highNs. The
+ * known interval is moved by whole periods to the observation, widened by the drift over those
+ * periods, and intersected with it. An observation that does not fit starts the phase again.
+ */
+void TemperatureSampler::observe(int64_t lowNs, int64_t highNs)
+{
+    if(!this->phaseKnown)
+    {
+        this->endLowNs   = lowNs;
+        this->endHighNs  = highNs;
+        this->phaseKnown = true;
+        return;
+    }
+    double periods = ((lowNs + highNs) / 2 - (this->endLowNs + this->endHighNs) / 2) / static_cast<double>(CONVERSION_PERIOD_NS);
+    int64_t k = llround(periods);
+    int64_t widen = static_cast<int64_t>(llabs(k) * CONVERSION_PERIOD_NS * this->maxDriftPpm * 1e-6);
+    int64_t low  = this->endLowNs + k * CONVERSION_PERIOD_NS - widen;
+    int64_t high = this->endHighNs + k * CONVERSION_PERIOD_NS + widen;
+    if(low < lowNs) low = lowNs;
+    if(high > highNs) high = highNs;
+    if(low > high)
+    {
+        low  = lowNs;
+        high = highNs;
+    }
+    this->endLowNs  = low;
+    this->endHighNs = high;
+}
+
+/**
+ * Moves the interval to the first conversion that may not have ended by nowNs.
+ */
+void TemperatureSampler::rollForward(int64_t nowNs)
+{
+    int64_t widen = static_cast<int64_t>(CONVERSION_PERIOD_NS * this->maxDriftPpm * 1e-6);
+    while(this->endHighNs < nowNs)
+    {
+        this->endLowNs  += CONVERSION_PERIOD_NS - widen;
+        this->endHighNs += CONVERSION_PERIOD_NS + widen;
+    }
+}
+
+/**
+ * Learns from a fresh reading, caches it until the next conversion can have ended and notifies
+ * the change callback if the reading left the deadband.
+ */
+void TemperatureSampler::store(int64_t nowNs, int16_t quarters, bool busy)
+{
+    // while BSY is set the registers still hold the previous value, the new one is latched at the end
+    if(busy) this->observe(nowNs, nowNs + CONVERSION_MAX_NS);
+    else if(this->cacheValid && quarters != this->cachedQuarters && nowNs - this->lastReadNs < CONVERSION_PERIOD_NS / 2)
+        this->observe(this->lastReadNs, nowNs);
+
+    this->cachedQuarters = quarters;
+    this->cacheValid     = true;
+    this->lastReadNs     = nowNs;
+    if(this->phaseKnown)
+    {
+        this->rollForward(nowNs);
+        // a wide interval is read at its start too, where BSY may be caught to narrow it
+        if(this->endHighNs - this->endLowNs > REFINE_WIDTH_NS && nowNs < this->endLowNs) this->expiresNs = this->endLowNs;
+        else this->expiresNs = this->endHighNs + EXPIRY_MARGIN_NS;
+    }
+    else this->expiresNs = nowNs + this->unknownTtlMs * NS_PER_MS;
+
+    if(this->changeCallback && (!this->notified || abs(quarters - this->notifiedQuarters) >= this->deadbandQuarters))
+    {
+        this->notified         = true;
+        this->notifiedQuarters = quarters;
+        this->changeCallback(quarters);
+    }
+}
+
+/**
+ * Returns the temperature, from the cache while no new conversion can have ended since it was
+ * read and from the bus otherwise.
+ *
+ * @param quarters Receives the temperature in quarter degrees Celsius
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int TemperatureSampler::get(int16_t& quarters)
+{
+    if(this->cacheValid && monotonic_ns() < this->expiresNs)
+    {
+        quarters = this->cachedQuarters;
+        return 0;
+    }
+    int64_t nowNs;
+    bool busy;
+    if(this->read(nowNs, quarters, busy)) return 1;
+    this->store(nowNs, quarters, busy);
+    return 0;
+}
+
+/**
+ * Finds the conversion phase by polling BSY every 100ms until a conversion is seen, then every 5ms
+ * until it ends. It blocks for up to one conversion period.
+ *
+ * @param timeoutMs How long to wait for a conversion before giving up
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int TemperatureSampler::learnPhase(int timeoutMs)
+{
+    int64_t deadline = monotonic_ns() + static_cast<int64_t>(timeoutMs) * NS_PER_MS;
+    this->phaseKnown = false;
+    int64_t nowNs;
+    int16_t quarters;
+    bool busy;
+    while(monotonic_ns() < deadline)
+    {
+        if(this->read(nowNs, quarters, busy)) return 1;
+        if(!busy)
+        {
+            this->store(nowNs, quarters, false);
+            if(this->phaseKnown) return 0;  // the value changed between two reads
+            sleep_until_ns(CLOCK_MONOTONIC, nowNs + LEARN_POLL_NS);
+            continue;
+        }
+        int64_t lastBusyNs = nowNs;
+        while(busy && nowNs < deadline)
+        {
+            lastBusyNs = nowNs;
+            sleep_until_ns(CLOCK_MONOTONIC, nowNs + BUSY_POLL_NS);
+            if(this->read(nowNs, quarters, busy)) return 1;
+        }
+        if(busy) break;
+        this->phaseKnown = false;
+        this->observe(lastBusyNs, nowNs);
+        this->store(nowNs, quarters, false);
+        return 0;
+    }
+    cerr << "RTC: No temperature conversion seen within " << timeoutMs << "ms" << endl;
+    return 1;
+}
+
+/**
+ * Returns when the cached reading expires, i.e. the earliest time get() reads the bus again.
+ *
+ * @return CLOCK_MONOTONIC in ns, now if nothing is cached
+ */
+int64_t TemperatureSampler::nextChangeNs()
+{
+    int64_t now = monotonic_ns();
+    if(!this->cacheValid || this->expiresNs < now) return now;
+    return this->expiresNs;
+}
+
+/**
+ * Sleeps until the cached reading expires, so a loop around get() reads each conversion once.
+ */
+void TemperatureSampler::sleepUntilNextChange()
+{
+    sleep_until_ns(CLOCK_MONOTONIC, this->nextChangeNs());
+}
+
+/**
+ * Sets the callback for changes of the temperature. It is called from get() with the first fresh
+ * reading and then whenever a fresh reading differs from the last notified one by the deadband.
+ *
+ * @param deadbandQuarters The change in quarter degrees that is notified, 0 notifies every reading
+ * @param callback The function to call with the new temperature in quarter degrees
+ */
+void TemperatureSampler::setChangeCallback(int16_t deadbandQuarters, temperature_change_t callback)
+{
+    this->deadbandQuarters = deadbandQuarters;
+    this->changeCallback   = callback;
+    this->notified         = false;
+}
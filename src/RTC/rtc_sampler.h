@@ -0,0 +1,64 @@
+#ifndef RTC_SAMPLER_H_
+#define RTC_SAMPLER_H_
+
+#include "rtc.h"
+#include <stdint.h>
+#include <functional>
+
+using temperature_change_t = std::function<void(int16_t quarters)>;
+
+/**
+ * @class TemperatureSampler
+ * @brief Serves the DS3231 temperature from a cache that lives until the next TCXO conversion.
+ *
+ * The temperature registers only change when the TCXO converts, every 64 seconds. The sampler
+ * learns when those conversions end on CLOCK_MONOTONIC, from BSY being seen set (a conversion ends
+ * within 200ms) and from the value changing between two reads (a conversion ended in between),
+ * and keeps an interval for the end of a conversion that is rolled forward a period at a time and
+ * widened by the drift between the RTC and CLOCK_MONOTONIC. A reading is cached until the latest
+ * time the next conversion can end, so get() only reads the bus when a new value can exist.
+ * learnPhase() finds the phase up front by polling BSY; until the phase is known readings are
+ * cached for unknownTtlMs.
+ *
+ * Conversions forced with CONV (requestTemperatureConversion(), setAgingOffset()) are not part
+ * of the 64 second cycle; their new value shows up at the next expiry of the cache.
+ *
+ * A change callback with a deadband is called, on the thread that calls get(), whenever a fresh
+ * reading differs from the last notified one by at least the deadband.
+ */
+class TemperatureSampler {
+private:
+    RTC& rtc;
+    double maxDriftPpm;
+    int unknownTtlMs;
+    bool phaseKnown;
+    int64_t endLowNs;               // a conversion ended between endLowNs and endHighNs
+    int64_t endHighNs;
+    bool cacheValid;
+    int16_t cachedQuarters;
+    int64_t lastReadNs;             // CLOCK_MONOTONIC of the last bus read
+    int64_t expiresNs;              // the cache is served until then
+    unsigned long reads;
+    int16_t deadbandQuarters;
+    bool notified;
+    int16_t notifiedQuarters;
+    temperature_change_t changeCallback;
+
+    int read(int64_t& nowNs, int16_t& quarters, bool& busy);
+    void observe(int64_t lowNs, int64_t highNs);
+    void rollForward(int64_t nowNs);
+    void store(int64_t nowNs, int16_t quarters, bool busy);
+
+public:
+    TemperatureSampler(RTC& rtc, double maxDriftPpm = 100.0, int unknownTtlMs = 1000);
+    int get(int16_t& quarters);
+    int learnPhase(int timeoutMs = 70000);
+    bool isPhaseKnown() { return this->phaseKnown; }
+    int64_t nextChangeNs();
+    void sleepUntilNextChange();
+    void setChangeCallback(int16_t deadbandQuarters, temperature_change_t callback);
+    void invalidate() { this->cacheValid = false; }
+    unsigned long busReads() { return this->reads; }
+};
+
+#endif
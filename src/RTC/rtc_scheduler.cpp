@@ -0,0 +1,183 @@
+#include <iostream>
+#include <algorithm>
+
+#include "rtc_scheduler.h"
+
+using namespace std;
+
+// orders the heap so that the earliest deadline, and of equal ones the first scheduled, is on top
+bool AlarmScheduler::later(const deadline_t& a, const deadline_t& b)
+{
+    if(a.due != b.due) return a.due > b.due;
+    return a.id > b.id;
+}
+
+/**
+ * Creates an empty scheduler. The alarms are only programmed once a deadline is scheduled.
+ *
+ * @param rtc The RTC whose alarms are used, it must outlive the scheduler.
+ * @param clock_12_hr The format the RTC keeps the time in, the alarms are written in the same one.
+ */
+AlarmScheduler::AlarmScheduler(RTC& rtc, CLOCK_FORMAT clock_12_hr) : rtc(rtc)
+{
+    this->clockFormat = clock_12_hr;
+    this->nextId      = 1;
+    this->dispatching = false;
+}
+
+void AlarmScheduler::pushDeadline(time_t due, scheduled_id_t id)
+{
+    this->heap.push_back({due, id});
+    push_heap(this->heap.begin(), this->heap.end(), later);
+}
+
+/**
+ * Finds the earliest deadline that is still scheduled, dropping cancelled ones from the top.
+ *
+ * @return true if there is one, false if nothing is scheduled
+ */
+bool AlarmScheduler::earliest(time_t& due)
+{
+    while(!this->heap.empty())
+    {
+        if(this->jobs.count(this->heap.front().id))
+        {
+            due = this->heap.front().due;
+            return true;
+        }
+        pop_heap(this->heap.begin(), this->heap.end(), later);
+        this->heap.pop_back();
+    }
+    return false;
+}
+
+/**
+ * Runs every deadline due at or before now. Periodic deadlines are put back one period on, or as
+ * many periods as it takes to get past now.
+ */
+void AlarmScheduler::runDue(time_t now)
+{
+    time_t due;
+    while(this->earliest(due) && due <= now)
+    {
+        scheduled_id_t id = this->heap.front().id;
+        pop_heap(this->heap.begin(), this->heap.end(), later);
+        this->heap.pop_back();
+
+        job_t& job = this->jobs[id];
+        scheduled_callback_t callback = job.callback;   // the callback may cancel its own job
+        if(job.periodSeconds)
+        {
+            time_t next = due + job.periodSeconds;
+            if(next <= now) next += ((now - next) / job.periodSeconds + 1) * job.periodSeconds;
+            this->pushDeadline(next, id);
+        }
+        else this->jobs.erase(id);
+        if(callback) callback(due);
+    }
+    // cancelled entries that never reach the top are swept once they outnumber the live ones
+    if(this->heap.size() > 2 * this->jobs.size() + 16)
+    {
+        vector<deadline_t> live;
+        for(const deadline_t& d : this->heap) if(this->jobs.count(d.id)) live.push_back(d);
+        this->heap.swap(live);
+        make_heap(this->heap.begin(), this->heap.end(), later);
+    }
+}
+
+/**
+ * Schedules a deadline and reprograms the alarms if it is now the earliest.
+ *
+ * @param due The RTC time to run the callback at, in seconds since the epoch
+ * @param callback The function to call, with the time the deadline was due at
+ * @param periodSeconds Repeats the deadline every periodSeconds, 0 runs it once
+ *
+ * @return the id of the deadline, for cancel(), 0 if the alarms could not be programmed
+ */
+scheduled_id_t AlarmScheduler::scheduleAt(time_t due, scheduled_callback_t callback, unsigned int periodSeconds)
+{
+    scheduled_id_t id = this->nextId++;
+    this->jobs[id] = {callback, periodSeconds};
+    this->pushDeadline(due, id);
+    if(this->rearm())
+    {
+        this->jobs.erase(id);
+        return 0;
+    }
+    return id;
+}
+
+/**
+ * Schedules a deadline a number of seconds after the current RTC time.
+ *
+ * @param seconds How far from now the deadline is
+ * @param callback The function to call, with the time the deadline was due at
+ * @param periodSeconds Repeats the deadline every periodSeconds, 0 runs it once
+ *
+ * @return the id of the deadline, for cancel(), 0 if the RTC could not be read or programmed
+ */
+scheduled_id_t AlarmScheduler::scheduleIn(unsigned int seconds, scheduled_callback_t callback, unsigned int periodSeconds)
+{
+    time_t now;
+    if(this->rtc.getEpoch(now))
+    {
+        cerr << "RTC: Unable to read the time to schedule from" << endl;
+        return 0;
+    }
+    return this->scheduleAt(now + seconds, callback, periodSeconds);
+}
+
+/**
+ * Cancels a deadline. The alarms are left as they are: if the cancelled deadline was the next one
+ * its alarm finds nothing due and programs the next deadline then.
+ *
+ * @param id The id scheduleAt() or scheduleIn() returned
+ *
+ * @return 0 if successful, 1 if no such deadline is scheduled
+ */
+int AlarmScheduler::cancel(scheduled_id_t id)
+{
+    return this->jobs.erase(id) ? 0 : 1;
+}
+
+/**
+ * Runs the deadlines that are due and programs the alarms for the next one, or disables them if
+ * nothing is scheduled. The time is read again after the alarms are written, so a deadline whose
+ * second went by in the meantime runs straight away instead of a month later.
+ *
+ * @return 0 if successful, 1 if unsuccessful
+ */
+int AlarmScheduler::rearm()
+{
+    if(this->dispatching) return 0;     // called from a callback, the outer call programs the alarms
+    this->dispatching = true;
+    int res = 0;
+    time_t now, next;
+    if(this->rtc.getEpoch(now)) res = 1;
+    while(!res)
+    {
+        this->runDue(now);
+        if(!this->earliest(next))
+        {
+            res = this->rtc.disableInterruptAlarm1() | this->rtc.disableInterruptAlarm2();
+            break;
+        }
+        time_t backstop = (next / 60 + 1) * 60;
+        if(this->rtc.setAlarmsAt(next, backstop, this->clockFormat) || this->rtc.getEpoch(now)) res = 1;
+        else if(now < next) break;
+    }
+    this->dispatching = false;
+    if(res) cerr << "RTC: Unable to program the next deadline" << endl;
+    return res;
+}
+
+/**
+ * Makes the service call rearm() on both alarms.
+ *
+ * @param service The AlarmService watching the INT/SQW pin of the same RTC
+ */
+void AlarmScheduler::attach(AlarmService& service)
+{
+    service.onAlarm1([this](int64_t) { this->rearm(); });
+    service.onAlarm2([this](int64_t) { this->rearm(); });
+}
@@ -0,0 +1,70 @@
+#ifndef RTC_SCHEDULER_H_
+#define RTC_SCHEDULER_H_
+
+#include "rtc.h"
+#include "rtc_alarm.h"
+#include <stdint.h>
+#include <ctime>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// identifies a scheduled deadline, 0 is never a valid id
+typedef uint64_t scheduled_id_t;
+
+// Called with the RTC time the deadline was due at
+using scheduled_callback_t = std::function<void(time_t due)>;
+
+/**
+ * @class AlarmScheduler
+ * @brief Any number of one-shot and periodic deadlines on top of the two DS3231 alarms.
+ *
+ * The deadlines, in RTC seconds since the epoch, are kept in a min-heap. The earliest one is
+ * programmed into Alarm 1 and the first minute boundary after it into Alarm 2, a coarse backstop
+ * in case Alarm 1 is lost, e.g. because other code reprogrammed it. Both are written in one burst
+ * that skips registers already holding the value. rearm() runs every deadline that is due and
+ * programs the next one; attach() makes an AlarmService call it on every alarm, so the process
+ * sleeps in the kernel until the next deadline with no timers of its own.
+ *
+ * Alarm 1 matches the date of the month, so a deadline more than a month ahead can wake the
+ * process early on the same date; nothing is due then and the alarm is simply programmed again.
+ * A periodic deadline that was missed by several periods runs once and keeps its phase.
+ *
+ * The scheduler is not thread safe: use it from the thread that runs the AlarmService, the
+ * callbacks may schedule and cancel deadlines.
+ */
+class AlarmScheduler {
+private:
+    typedef struct deadline_t {
+        time_t due;
+        scheduled_id_t id;
+    } deadline_t;
+    typedef struct job_t {
+        scheduled_callback_t callback;
+        unsigned int periodSeconds;     // 0 for a one-shot deadline
+    } job_t;
+
+    RTC& rtc;
+    CLOCK_FORMAT clockFormat;
+    std::vector<deadline_t> heap;       // min-heap on due, cancelled entries are dropped when they surface
+    std::unordered_map<scheduled_id_t, job_t> jobs;
+    scheduled_id_t nextId;
+    bool dispatching;                   // rearm() is running, it programs the alarms when it is done
+
+    static bool later(const deadline_t& a, const deadline_t& b);
+    void pushDeadline(time_t due, scheduled_id_t id);
+    bool earliest(time_t& due);
+    void runDue(time_t now);
+
+public:
+    AlarmScheduler(RTC& rtc, CLOCK_FORMAT clock_12_hr = FORMAT_0_23);
+    scheduled_id_t scheduleAt(time_t due, scheduled_callback_t callback, unsigned int periodSeconds = 0);
+    scheduled_id_t scheduleIn(unsigned int seconds, scheduled_callback_t callback, unsigned int periodSeconds = 0);
+    int cancel(scheduled_id_t id);
+    int rearm();
+    void attach(AlarmService& service);
+    size_t pending() { return this->jobs.size(); }
+    bool nextDeadline(time_t& due) { return this->earliest(due); }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <math.h>
+
+#include "rtc_tempco.h"
+
+#define TURNOVER_C  25.0    // the curve is centred here to keep the fit well conditioned
+
+/**
+ * Creates an empty model.
+ */
+TemperatureDriftModel::TemperatureDriftModel()
+{
+    this->reset();
+}
+
+/**
+ * Forgets every sample and the fitted curve.
+ */
+void TemperatureDriftModel::reset()
+{
+    for(int i = 0; i < TEMPCO_BINS; i++) this->bins[i] = tempco_bin_t{0.0f, 0.0f};
+    for(int i = 0; i < 3; i++) this->coefficients[i] = 0;
+    this->fitted = false;
+}
+
+/**
+ * Returns the bin of a temperature, temperatures outside the range go to the first or last bin.
+ */
+int TemperatureDriftModel::binIndex(float temperature)
+{
+    int index = static_cast<int>(lroundf(temperature)) - TEMPCO_MIN_C;
+    if(index < 0) return 0;
+    if(index >= TEMPCO_BINS) return TEMPCO_BINS - 1;
+    return index;
+}
+
+/**
+ * Adds a measured drift to the bin of the temperature it was measured at.
+ *
+ * @param temperature The temperature of the RTC during the measurement, e.g. from RTC::getTemperature()
+ * @param driftPpm The drift measured, positive if the RTC runs fast
+ */
+void TemperatureDriftModel::add(float temperature, double driftPpm)
+{
+    tempco_bin_t& b = this->bins[binIndex(temperature)];
+    if(b.weight < TEMPCO_MAX_WEIGHT) b.weight += 1.0f;
+    b.driftPpm += static_cast<float>((driftPpm - b.driftPpm) / b.weight);
+}
+
+/**
+ * Fits the quadratic to the bins by weighted least squares, in O(bins).
+ *
+ * @return 0 if successful, 1 if fewer than three temperatures have been seen
+ */
+int TemperatureDriftModel::fit()
+{
+    // sums of w x^k for k = 0..4 and of w x^k y for k = 0..2, x centred on the turnover point
+    double sx[5] = {0, 0, 0, 0, 0};
+    double sxy[3] = {0, 0, 0};
+    int populated = 0;
+    for(int i = 0; i < TEMPCO_BINS; i++)
+    {
+        const tempco_bin_t& b = this->bins[i];
+        if(b.weight <= 0) continue;
+        populated++;
+        double x = i + TEMPCO_MIN_C - TURNOVER_C;
+        double p = b.weight;
+        for(int k = 0; k < 5; k++, p *= x)
+        {
+            sx[k] += p;
+            if(k < 3) sxy[k] += p * b.driftPpm;
+        }
+    }
+    if(populated < 3) return 1;
+
+    // solve the normal equations with Cramer's rule
+    double m[3][3] = {{sx[0], sx[1], sx[2]}, {sx[1], sx[2], sx[3]}, {sx[2], sx[3], sx[4]}};
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if(fabs(det) < 1e-12) return 1;
+    for(int c = 0; c < 3; c++)
+    {
+        double a[3][3];
+        for(int r = 0; r < 3; r++)
+            for(int k = 0; k < 3; k++) a[r][k] = (k == c) ? sxy[r] : m[r][k];
+        this->coefficients[c] = (a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                               - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                               + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0])) / det;
+    }
+    this->fitted = true;
+    return 0;
+}
+
+/**
+ * Predicts the drift of the RTC at a temperature, from its bin if that has enough samples and from
+ * the fitted curve otherwise.
+ *
+ * @param temperature The temperature of the RTC
+ * @param driftPpm Receives the predicted drift, positive if the RTC runs fast
+ *
+ * @return 0 if successful, 1 if there is neither a trusted bin nor a fitted curve
+ */
+int TemperatureDriftModel::predictDriftPpm(float temperature, double& driftPpm)
+{
+    const tempco_bin_t& b = this->bins[binIndex(temperature)];
+    if(b.weight >= TEMPCO_MIN_WEIGHT)
+    {
+        driftPpm = b.driftPpm;
+        return 0;
+    }
+    if(!this->fitted) return 1;
+    double x = temperature - TURNOVER_C;
+    driftPpm = this->coefficients[0] + x * (this->coefficients[1] + x * this->coefficients[2]);
+    return 0;
+}
+
+/**
+ * Predicts the frequency correction that cancels the drift of the RTC at a temperature.
+ *
+ * @param temperature The temperature of the RTC
+ * @param correctionPpm Receives the correction, the negative of the predicted drift
+ *
+ * @return 0 if successful, 1 if there is no prediction
+ */
+int TemperatureDriftModel::predictCorrectionPpm(float temperature, double& correctionPpm)
+{
+    double driftPpm;
+    if(this->predictDriftPpm(temperature, driftPpm)) return 1;
+    correctionPpm = -driftPpm;
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef RTC_TEMPCO_H_
+#define RTC_TEMPCO_H_
+
+#define TEMPCO_MIN_C        -40     // the operating range of the DS3231
+#define TEMPCO_MAX_C        85
+#define TEMPCO_BINS         (TEMPCO_MAX_C - TEMPCO_MIN_C + 1)  // one bin per degree
+#define TEMPCO_MAX_WEIGHT   1000.0f // older samples fade once a bin holds this many
+#define TEMPCO_MIN_WEIGHT   4.0f    // samples a bin needs before it is trusted over the curve
+
+// typedef struct to store the drift measured around one temperature
+typedef struct tempco_bin_t {
+    float weight;           // number of samples, capped at TEMPCO_MAX_WEIGHT
+    float driftPpm;         // their mean drift, positive if the RTC runs fast
+} tempco_bin_t;
+
+/**
+ * @class TemperatureDriftModel
+ * @brief Per-unit model of the drift the temperature compensation of the DS3231 leaves behind.
+ *
+ * Pairs of temperature and measured drift are averaged into one degree bins. A bin that is full
+ * turns into a moving average, so the model follows the slow aging of the crystal. fit() fits the
+ * quadratic drift(T) = c0 + c1 (T - 25) + c2 (T - 25)^2 of a crystal around its turnover point to
+ * the bins, weighted by their samples. The prediction uses the bin of the temperature when it has
+ * enough samples and the curve otherwise, so temperatures that were never seen still get one.
+ *
+ * The memory is the fixed table of TEMPCO_BINS bins and nothing is allocated per sample, so the
+ * model can be fed for the life of the unit.
+ */
+class TemperatureDriftModel {
+private:
+    tempco_bin_t bins[TEMPCO_BINS];
+    double coefficients[3];
+    bool fitted;
+
+    static int binIndex(float temperature);
+
+public:
+    TemperatureDriftModel();
+    void reset();
+    void add(float temperature, double driftPpm);
+    int fit();
+    int predictDriftPpm(float temperature, double& driftPpm);
+    int predictCorrectionPpm(float temperature, double& correctionPpm);
+    const tempco_bin_t& bin(float temperature) { return this->bins[binIndex(temperature)]; }
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef RTC_TIME_H_
+#define RTC_TIME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <chrono>
+
+#include "rtc.h"
+#include "bcd.h"
+#include "rtc_registers.h"
+
+/*
+ * Conversions between the DS3231 time registers (0x00 through 0x06) and seconds since the Unix
+ * epoch, without localtime(), mktime() or any other libc time call. The registers hold UTC.
+ *
+ * The calendar arithmetic is the days-from-civil / civil-from-days algorithm on the proleptic
+ * Gregorian calendar. The year is 2000 + the year register, plus 100 when the century bit of the
+ * month register is set, so the registers cover 2000 through 2199. Note that the DS3231 itself
+ * treats 2100 as a leap year, so its date drifts by a day from 01/03/2100 on.
+ */
+
+// std::chrono::sys_seconds, which is only part of the standard library from C++20 on
+using rtc_sys_seconds = std::chrono::time_point<std::chrono::system_clock, std::chrono::seconds>;
+
+// typedef struct to store a date of the Gregorian calendar
+typedef struct civil_date_t {
+    int64_t year;
+    unsigned month;         // 1 to 12
+    unsigned day;           // 1 to 31
+} civil_date_t;
+
+#define SECONDS_PER_DAY 86400
+#define NS_PER_SECOND   1000000000LL
+
+/**
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+inline int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * NS_PER_SECOND + ts.tv_nsec;
+}
+
+/**
+ * Returns CLOCK_MONOTONIC in seconds.
+ */
+inline double monotonic_seconds()
+{
+    return monotonic_ns() * 1e-9;
+}
+
+/**
+ * Sleeps until an absolute time on a clock. The sleep is resumed after a signal, unless the signal
+ * cleared `running`, so a loop that is stopped from a signal handler sees it straight away.
+ *
+ * @param clock CLOCK_MONOTONIC or CLOCK_REALTIME
+ * @param untilNs The time to wake up at on that clock, in nanoseconds
+ * @param running The sleep ends early when this is false after a signal, NULL to always resume
+ *
+ * @return 0 when the time is reached, 1 if the sleep failed or was ended early
+ */
+inline int sleep_until_ns(clockid_t clock, int64_t untilNs, const volatile bool* running = NULL)
+{
+    struct timespec ts;
+    ts.tv_sec  = untilNs / NS_PER_SECOND;
+    ts.tv_nsec = untilNs % NS_PER_SECOND;
+    int res;
+    while((res = clock_nanosleep(clock, TIMER_ABSTIME, &ts, NULL)) == EINTR)
+        if(running && !*running) return 1;
+    return res != 0;
+}
+
+/**
+ * Returns the number of days from 01/01/1970 to the date.
+ */
+constexpr int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(year - era * 400);                   // year of era [0, 399]
+    const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // day of year from March [0, 365]
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;                     // day of era [0, 146096]
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+/**
+ * Returns the date that lies the number of days after 01/01/1970.
+ */
+constexpr civil_date_t civil_from_days(int64_t days)
+{
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(days - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned day = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    return civil_date_t{static_cast<int64_t>(yoe) + era * 400 + (month <= 2), month, day};
+}
+
+/**
+ * Returns the day of the week of the date that lies the number of days after 01/01/1970,
+ * 1 for Sunday through 7 for Saturday, the numbering that setCurrentTimeToRTC uses.
+ */
+constexpr uint8_t weekday_from_days(int64_t days)
+{
+    return static_cast<uint8_t>((days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6) + 1);
+}
+
+/**
+ * Converts the time registers 0x00 through 0x06 to seconds since the epoch, in 12 or 24 hour mode
+ * and with the century bit.
+ */
+constexpr int64_t rtc_registers_to_epoch(const uint8_t* regs)
+{
+    uint8_t hours = field_time_clock_12hr::get(regs)
+        ? static_cast<uint8_t>(field_time_hours_12::get(regs) % 12 + (field_time_am_pm::get(regs) ? 12 : 0))
+        : field_time_hours_24::get(regs);
+    int64_t year = 2000 + field_time_year::get(regs) + (field_time_century::get(regs) ? 100 : 0);
+    int64_t days = days_from_civil(year, field_time_month::get(regs), field_time_date_of_month::get(regs));
+    return days * SECONDS_PER_DAY + hours * 3600 + field_time_minutes::get(regs) * 60 + field_time_seconds::get(regs);
+}
+
+/**
+ * Encodes seconds since the epoch into the time registers 0x00 through 0x06, including the day of
+ * the week and the century bit. Times outside 2000 through 2199 wrap around the two centuries.
+ *
+ * @param epoch The time to encode
+ * @param clock_12_hr FORMAT_0_12 or FORMAT_0_23 for the hours register
+ * @param regs Receives the seven registers
+ */
+constexpr void rtc_epoch_to_registers(int64_t epoch, CLOCK_FORMAT clock_12_hr, uint8_t* regs)
+{
+    int64_t days = (epoch >= 0 ? epoch : epoch - (SECONDS_PER_DAY - 1)) / SECONDS_PER_DAY;
+    int64_t seconds_of_day = epoch - days * SECONDS_PER_DAY;
+    civil_date_t date = civil_from_days(days);
+    uint8_t hours = static_cast<uint8_t>(seconds_of_day / 3600);
+    int64_t year_of_range = ((date.year - 2000) % 200 + 200) % 200;
+
+    regs[0] = field_time_seconds::encode(static_cast<uint8_t>(seconds_of_day % 60));
+    regs[1] = field_time_minutes::encode(static_cast<uint8_t>((seconds_of_day / 60) % 60));
+    if(clock_12_hr)
+        regs[2] = field_time_clock_12hr::encode(FORMAT_0_12) | field_time_am_pm::encode(hours >= 12 ? PM : AM) |
+                  field_time_hours_12::encode(hours % 12 == 0 ? 12 : hours % 12);
+    else
+        regs[2] = field_time_hours_24::encode(hours);
+    regs[3] = field_time_day_of_week::encode(weekday_from_days(days));
+    regs[4] = field_time_date_of_month::encode(static_cast<uint8_t>(date.day));
+    regs[5] = field_time_month::encode(static_cast<uint8_t>(date.month)) | field_time_century::encode(year_of_range >= 100);
+    regs[6] = field_time_year::encode(static_cast<uint8_t>(year_of_range % 100));
+}
+
+/**
+ * Converts the time registers 0x00 through 0x06 to a std::chrono time point.
+ */
+constexpr rtc_sys_seconds rtc_registers_to_sys_seconds(const uint8_t* regs)
+{
+    return rtc_sys_seconds(std::chrono::seconds(rtc_registers_to_epoch(regs)));
+}
+
+/**
+ * Encodes a std::chrono time point into the time registers 0x00 through 0x06.
+ */
+constexpr void rtc_sys_seconds_to_registers(rtc_sys_seconds t, CLOCK_FORMAT clock_12_hr, uint8_t* regs)
+{
+    rtc_epoch_to_registers(t.time_since_epoch().count(), clock_12_hr, regs);
+}
+
+/**
+ * Converts a decoded `user_time_t` to seconds since the epoch. The struct has no century, so the
+ * caller says which one it is in.
+ */
+constexpr int64_t rtc_user_time_to_epoch(const user_time_t& t, bool century = false)
+{
+    uint8_t hours = t.clock_12hr ? static_cast<uint8_t>(t.hours % 12 + (t.am_pm == PM ? 12 : 0)) : t.hours;
+    int64_t days = days_from_civil(2000 + t.year + (century ? 100 : 0), t.month, t.date_of_month);
+    return days * SECONDS_PER_DAY + hours * 3600 + t.minutes * 60 + t.seconds;
+}
+
+/**
+ * Converts the time registers of many register files at once, e.g. snapshots archived from a
+ * device or a fleet.
+ *
+ * @param files The first register file, each starts at register 0x00
+ * @param stride The distance in bytes between consecutive register files
+ * @param count The number of register files
+ * @param out Receives the seconds since the epoch of each register file
+ */
+inline void rtc_registers_to_epoch_batch(const uint8_t* files, size_t stride, size_t count, int64_t* out)
+{
+    for(size_t n = 0; n < count; n++) out[n] = rtc_registers_to_epoch(files + n * stride);
+}
+
+#endif
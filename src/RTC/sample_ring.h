@@ -0,0 +1,100 @@
+#ifndef SAMPLE_RING_H_
+#define SAMPLE_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+
+#define CACHE_LINE_SIZE 64
+
+// typedef struct to store a timestamped sample of the RTC
+typedef struct rtc_sample_t {
+    uint64_t sequence;          // counts every sample taken, a gap means samples were dropped
+    int64_t monotonic_ns;       // CLOCK_MONOTONIC when the sample was taken
+    int64_t realtime_ns;        // CLOCK_REALTIME when the sample was taken
+    time_t rtc_epoch;           // the RTC time, seconds since the epoch
+    int16_t temperature_quarters; // the temperature in quarter degrees Celsius
+} rtc_sample_t;
+
+/**
+ * @class SpscRing
+ * @brief Fixed capacity, lock-free ring between exactly one producer thread and one consumer thread.
+ *
+ * push() never blocks: when the ring is full the sample is dropped and counted as an overrun, so
+ * a slow consumer can never hold up the producer. The producer and consumer indices live on their
+ * own cache lines, each next to the copy of the other index that its side caches, so the two
+ * threads only share a cache line when one has to look at the other's progress. For more than one
+ * consumer, give each its own ring.
+ *
+ * @tparam T The sample type, copied in and out
+ * @tparam Capacity The number of slots, a power of two
+ */
+template<typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;     // next slot to write, written by the producer
+    size_t cachedTail;                                      // the producer's copy of tail
+    std::atomic<uint64_t> overruns;                         // samples dropped because the ring was full
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;     // next slot to read, written by the consumer
+    size_t cachedHead;                                      // the consumer's copy of head
+    alignas(CACHE_LINE_SIZE) T slots[Capacity];
+
+public:
+    SpscRing() : head(0), cachedTail(0), overruns(0), tail(0), cachedHead(0) {}
+
+    /**
+     * Adds a sample, from the producer thread only.
+     *
+     * @return true if the sample was added, false if the ring was full and it was dropped
+     */
+    bool push(const T& sample)
+    {
+        size_t h = this->head.load(std::memory_order_relaxed);
+        if(h - this->cachedTail == Capacity)
+        {
+            this->cachedTail = this->tail.load(std::memory_order_acquire);
+            if(h - this->cachedTail == Capacity)
+            {
+                this->overruns.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        this->slots[h & (Capacity - 1)] = sample;
+        this->head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Takes the oldest sample, from the consumer thread only.
+     *
+     * @return true if a sample was taken, false if the ring was empty
+     */
+    bool pop(T& sample)
+    {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        if(t == this->cachedHead)
+        {
+            this->cachedHead = this->head.load(std::memory_order_acquire);
+            if(t == this->cachedHead) return false;
+        }
+        sample = this->slots[t & (Capacity - 1)];
+        this->tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // the number of samples waiting, exact only when called from one of the two threads while the other is idle
+    size_t size() const
+    {
+        return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+    }
+
+    // the number of samples dropped so far, from either thread
+    uint64_t overrunCount() const { return this->overruns.load(std::memory_order_relaxed); }
+
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include <iostream>
+#include <errno.h>
+#include <chrono>
+#include <system_error>
+#include <gpiod.hpp>
+
+#include "timer_wheel.h"
+
+using namespace std;
+
+/**
+ * Creates an empty wheel at tick 0.
+ *
+ * @param reserve The number of timers to make room for up front
+ */
+TimerWheel::TimerWheel(size_t reserve)
+{
+    this->nodes.reserve(reserve);
+    this->freeList = WHEEL_NIL;
+    for(int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) this->slots[i] = WHEEL_NIL;
+    this->now    = 0;
+    this->active = 0;
+}
+
+/**
+ * Puts a node into the slot of the lowest level whose range covers its expiry. A timer beyond the
+ * top level waits in the top level slot that comes round last and is placed again from there.
+ */
+void TimerWheel::link(uint32_t index)
+{
+    wheel_node_t& node = this->nodes[index];
+    uint64_t delta = node.expires - this->now;
+    int level = 0;
+    while(level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_SLOT_BITS * (level + 1)))) level++;
+    uint64_t at = node.expires;
+    if(delta >= (1ULL << (WHEEL_SLOT_BITS * WHEEL_LEVELS))) at = this->now + (1ULL << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1;
+    uint16_t slot = static_cast<uint16_t>(level * WHEEL_SLOTS + ((at >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)));
+
+    node.slot = slot;
+    node.prev = WHEEL_NIL;
+    node.next = this->slots[slot];
+    if(node.next != WHEEL_NIL) this->nodes[node.next].prev = index;
+    this->slots[slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index)
+{
+    wheel_node_t& node = this->nodes[index];
+    if(node.prev != WHEEL_NIL) this->nodes[node.prev].next = node.next;
+    else this->slots[node.slot] = node.next;
+    if(node.next != WHEEL_NIL) this->nodes[node.next].prev = node.prev;
+}
+
+// returns an unlinked node to the pool
+void TimerWheel::release(uint32_t index)
+{
+    wheel_node_t& node = this->nodes[index];
+    node.active = false;
+    node.generation++;
+    node.callback = nullptr;
+    node.next = this->freeList;
+    this->freeList = index;
+    this->active--;
+}
+
+/**
+ * Places the timers of the current slot of a level again, into the levels below.
+ */
+void TimerWheel::cascade(int level)
+{
+    uint16_t slot = static_cast<uint16_t>(level * WHEEL_SLOTS + ((this->now >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)));
+    uint32_t index = this->slots[slot];
+    this->slots[slot] = WHEEL_NIL;
+    while(index != WHEEL_NIL)
+    {
+        uint32_t next = this->nodes[index].next;
+        this->link(index);
+        index = next;
+    }
+}
+
+/**
+ * Adds a timer.
+ *
+ * @param seconds The number of ticks until the timer runs, at least 1
+ * @param callback The function to call when it runs
+ *
+ * @return the id of the timer, for cancel()
+ */
+wheel_timer_t TimerWheel::add(uint32_t seconds, wheel_callback_t callback)
+{
+    uint32_t index;
+    if(this->freeList != WHEEL_NIL)
+    {
+        index = this->freeList;
+        this->freeList = this->nodes[index].next;
+    }
+    else
+    {
+        index = static_cast<uint32_t>(this->nodes.size());
+        this->nodes.push_back(wheel_node_t{0, WHEEL_NIL, WHEEL_NIL, 1, 0, false, nullptr});
+    }
+    wheel_node_t& node = this->nodes[index];
+    node.expires  = this->now + (seconds ? seconds : 1);    // never the tick that is running
+    node.active   = true;
+    node.callback = std::move(callback);
+    this->link(index);
+    this->active++;
+    return (static_cast<uint64_t>(node.generation) << 32) | (index + 1);
+}
+
+/**
+ * Cancels a timer that has not run yet.
+ *
+ * @param id The id add() returned
+ *
+ * @return 0 if successful, 1 if the timer already ran or was cancelled
+ */
+int TimerWheel::cancel(wheel_timer_t id)
+{
+    uint32_t index = static_cast<uint32_t>(id & 0xFFFFFFFF) - 1;
+    if(index >= this->nodes.size()) return 1;
+    wheel_node_t& node = this->nodes[index];
+    if(!node.active || node.generation != static_cast<uint32_t>(id >> 32)) return 1;
+    this->unlink(index);
+    this->release(index);
+    return 0;
+}
+
+/**
+ * Advances the wheel by one second and runs the timers that expire. When a level wraps round, the
+ * next slot of the level above is cascaded down first.
+ */
+void TimerWheel::tick()
+{
+    this->now++;
+    // from the top down, a timer cascaded into a lower level that wraps now is cascaded again
+    for(int level = WHEEL_LEVELS - 1; level >= 1; level--)
+        if(!(this->now & ((1ULL << (WHEEL_SLOT_BITS * level)) - 1))) this->cascade(level);
+
+    // level 0 only holds timers of the next 64 ticks, so every timer in this slot expires now
+    uint16_t slot = static_cast<uint16_t>(this->now & (WHEEL_SLOTS - 1));
+    while(this->slots[slot] != WHEEL_NIL)
+    {
+        uint32_t index = this->slots[slot];
+        this->unlink(index);
+        wheel_callback_t callback = std::move(this->nodes[index].callback);
+        this->release(index);
+        if(callback) callback();    // may add timers, which can move this->nodes
+    }
+}
+
+/**
+ * Advances the wheel by several seconds, a tick at a time.
+ */
+void TimerWheel::advance(uint64_t ticks)
+{
+    while(ticks--) this->tick();
+}
+
+/**
+ * Ticks the wheel on every falling edge of the 1Hz square wave until `running` is cleared. The
+ * square wave must already be enabled with RTC::enableSquareWave(SQW_1HZ).
+ *
+ * @param gpioChip The GPIO chip the INT/SQW pin is connected to, e.g. "gpiochip0" ("gpiochip4" on a Pi 5).
+ * @param gpioLine The line offset of the INT/SQW pin on that chip.
+ * @param running The loop stops when this becomes false
+ *
+ * @return 0 when stopped, 1 if the line could not be used
+ */
+int TimerWheel::runOnSquareWave(const std::string& gpioChip, unsigned int gpioLine, volatile bool& running)
+{
+    try
+    {
+        gpiod::chip chip(gpioChip);
+        gpiod::line line = chip.get_line(gpioLine);
+        line.request({"ds3231-wheel", gpiod::line_request::EVENT_FALLING_EDGE, 0});
+        while(running)
+        {
+            try
+            {
+                if(!line.event_wait(chrono::milliseconds(2000)))
+                {
+                    cerr << "RTC: No square wave edge for 2 seconds" << endl;
+                    continue;
+                }
+                // every edge the kernel queued is a tick, also the ones missed while the wheel ran late
+                for(const gpiod::line_event& edge : line.event_read_multiple())
+                    if(edge.event_type == gpiod::line_event::FALLING_EDGE) this->tick();
+            }
+            catch(const system_error& e)
+            {
+                if(e.code().value() != EINTR) throw;
+            }
+        }
+        line.release();
+    }
+    catch(const system_error& e)
+    {
+        cerr << "RTC: Unable to use the square wave line: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
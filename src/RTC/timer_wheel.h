@@ -0,0 +1,72 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <functional>
+#include <vector>
+
+#define WHEEL_LEVELS        4
+#define WHEEL_SLOT_BITS     6
+#define WHEEL_SLOTS         (1 << WHEEL_SLOT_BITS)  // 64 slots per level
+#define WHEEL_NIL           0xFFFFFFFFu
+
+// identifies a timer, 0 is never a valid id
+typedef uint64_t wheel_timer_t;
+
+using wheel_callback_t = std::function<void()>;
+
+/**
+ * @class TimerWheel
+ * @brief Hierarchical timing wheel with a one second tick, for thousands of timeouts.
+ *
+ * Four levels of 64 slots cover 64 seconds, 68 minutes, 3 days and 194 days; a timer further out
+ * waits in the top level and is placed again when it comes round. A timer sits in the slot of the
+ * lowest level whose range covers it, in an intrusive doubly linked list of pooled nodes, so add()
+ * and cancel() are O(1) and allocate nothing once the pool has grown. tick() runs the level 0
+ * slot of the new second; every 64 ticks the next slot of level 1 is cascaded down, and so on.
+ *
+ * The tick comes from the 1Hz square wave of the DS3231 through runOnSquareWave(): one falling
+ * edge of INT/SQW per second, each read from libgpiod, instead of a timerfd per timeout. The
+ * kernel queues the edges, so a reader that was held up catches up a tick per edge. The square
+ * wave uses INT/SQW, so the alarms cannot interrupt while it runs.
+ *
+ * The wheel is not thread safe: use it from the thread that ticks it, the callbacks may add and
+ * cancel timers.
+ */
+class TimerWheel {
+private:
+    typedef struct wheel_node_t {
+        uint64_t expires;       // the tick the timer runs at
+        uint32_t next;          // neighbours in the slot, or the next free node
+        uint32_t prev;
+        uint32_t generation;    // bumped when the node is freed, so stale ids do not match
+        uint16_t slot;          // level * WHEEL_SLOTS + index of the slot holding the node
+        bool active;
+        wheel_callback_t callback;
+    } wheel_node_t;
+
+    std::vector<wheel_node_t> nodes;
+    uint32_t freeList;
+    uint32_t slots[WHEEL_LEVELS * WHEEL_SLOTS];
+    uint64_t now;               // ticks so far
+    size_t active;
+
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(int level);
+
+public:
+    TimerWheel(size_t reserve = 1024);
+    wheel_timer_t add(uint32_t seconds, wheel_callback_t callback);
+    int cancel(wheel_timer_t id);
+    void tick();
+    void advance(uint64_t ticks);
+    int runOnSquareWave(const std::string& gpioChip, unsigned int gpioLine, volatile bool& running);
+    uint64_t ticks() { return this->now; }
+    size_t pending() { return this->active; }
+};
+
+#endif
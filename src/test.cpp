@@ -8,10 +8,25 @@
 #include <arpa/inet.h>
 #include <thread>
 #include <chrono>
+#include <vector>
+#include <cstdlib>
 
 #include "linux.cpp" // PAHO MQTT Dependency
 #include "MQTTClient.h"
 #include "RTC/rtc.h"
+#include "RTC/ds3231_sim.h"
+#include "RTC/rtc_edge.h"
+#include "RTC/rtc_alarm.h"
+#include "RTC/rtc_scheduler.h"
+#include "RTC/rtc_cron.h"
+#include "RTC/timer_wheel.h"
+#include "RTC/rtc_discipline.h"
+#include "RTC/rtc_aging.h"
+#include "RTC/rtc_sampler.h"
+#include "RTC/sample_ring.h"
+#include "RTC/bcd.h"
+#include "RTC/rtc_registers.h"
+#include "RTC/rtc_time.h"
 
 using namespace std;
 
@@ -27,15 +42,77 @@ using namespace std;
 // #define TEST_SQW                     // Runs once
 // #define TEST_WITH_MQTT               // Runs indefinitely, REQUIRES A CONNECTION TO AN MQTT BROKER
 // #define TEST_32kHz                   // Runs indefinitely
+// #define TEST_SECONDS_EDGE            // Runs once
+// #define TEST_BCD_BENCHMARK           // Runs once, does not need the module
+// #define TEST_ALIGNED_SET             // Runs once
+// #define TEST_DISCIPLINE              // Runs indefinitely, Ctrl+C to stop, needs root to adjust the clock
+// #define TEST_AGING_CALIBRATION       // Runs indefinitely, Ctrl+C to stop, needs NTP
+// #define TEST_TEMPERATURE_SAMPLER     // Runs indefinitely, Ctrl+C to stop
+// #define TEST_ALARM_SCHEDULER         // Runs indefinitely, Ctrl+C to stop
+// #define TEST_CRON                    // Runs indefinitely, Ctrl+C to stop
+// #define TEST_TIMER_WHEEL             // Runs indefinitely, Ctrl+C to stop
+// #define TEST_APPLY_CONFIG            // Runs once
+// #define TEST_REGISTER_MAP            // Runs once
 
 ///////////////// RUN THE TESTS BELOW ONE BY ONE ///////////////////////////
 
+// #define USE_SIMULATOR                // Runs the tests against the DS3231Simulator instead of /dev/i2c-1
+
 // MQTT PARAMETERS
 #define HOSTNAME "broker.emqx.io"
 #define PORT 1883
 #define DEVICE_ID "DS3231_Raspberry_Pi_5"
 #define TOPIC "temperature"
 
+#ifdef TEST_BCD_BENCHMARK
+/**
+ * Decodes the time registers field by field with a multiply per byte, the way the RTC class
+ * did before the lookup tables. It is the baseline of the benchmark.
+ */
+static void per_field_decode(const uint8_t *regs, uint8_t out[7])
+{
+    static const uint8_t masks[7] = {0x7F, 0x7F, 0x3F, 0x07, 0x3F, 0x1F, 0xFF};
+    for (int i = 0; i < 7; i++)
+    {
+        uint8_t value = regs[i] & masks[i];
+        if (i == 2 && (regs[2] & 0x40)) value &= 0x1F;
+        out[i] = (value & 0xF) + 10 * (value >> 4);
+    }
+}
+
+/**
+ * Decodes the time registers field by field with the lookup table.
+ */
+static void table_decode(const uint8_t *regs, uint8_t out[7])
+{
+    static const uint8_t masks[7] = {0x7F, 0x7F, 0x3F, 0x07, 0x3F, 0x1F, 0xFF};
+    for (int i = 0; i < 7; i++)
+    {
+        uint8_t value = regs[i] & masks[i];
+        if (i == 2 && (regs[2] & 0x40)) value &= 0x1F;
+        out[i] = bcd_to_decimal(value);
+    }
+}
+
+/**
+ * Times a decoder over a set of register files and prints the cost per register file.
+ */
+template <typename Decoder>
+static void benchmark(const char *name, const vector<uint8_t> &files, size_t count, Decoder decode)
+{
+    vector<uint8_t> out(count * 7);
+    unsigned checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < 100; round++)
+    {
+        decode(files.data(), count, reinterpret_cast<uint8_t(*)[7]>(out.data()));
+        checksum += out[round % out.size()];
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << name << ": " << static_cast<double>(elapsed) / (100.0 * count) << " ns per register file (checksum " << checksum << ")" << endl;
+}
+#endif
+
 // Global variable to control the loop
 volatile bool running = true;
 
@@ -132,8 +209,42 @@ int main()
 // //////////////////// MQTT CONNECTION /////////////////////
 #endif
 
+#ifdef TEST_BCD_BENCHMARK
+    // compares the per field BCD decoding with the lookup tables, the SWAR decoder and the batch decoder
+    const size_t count = 100000;
+    vector<uint8_t> files(count * DS3231_NUM_REGISTERS);
+    srand(1);
+    for (size_t n = 0; n < count; n++)
+    {
+        uint8_t *regs = &files[n * DS3231_NUM_REGISTERS];
+        regs[0] = decimal_to_bcd(rand() % 60);
+        regs[1] = decimal_to_bcd(rand() % 60);
+        regs[2] = (rand() % 2) ? (0x40 | ((rand() % 2) << 5) | decimal_to_bcd(1 + rand() % 12)) : decimal_to_bcd(rand() % 24);
+        regs[3] = decimal_to_bcd(1 + rand() % 7);
+        regs[4] = decimal_to_bcd(1 + rand() % 28);
+        regs[5] = decimal_to_bcd(1 + rand() % 12);
+        regs[6] = decimal_to_bcd(rand() % 100);
+    }
+    benchmark("Per field arithmetic", files, count, [](const uint8_t *f, size_t c, uint8_t (*o)[7]) {
+        for (size_t n = 0; n < c; n++) per_field_decode(f + n * DS3231_NUM_REGISTERS, o[n]);
+    });
+    benchmark("Per field table", files, count, [](const uint8_t *f, size_t c, uint8_t (*o)[7]) {
+        for (size_t n = 0; n < c; n++) table_decode(f + n * DS3231_NUM_REGISTERS, o[n]);
+    });
+    benchmark("SWAR", files, count, [](const uint8_t *f, size_t c, uint8_t (*o)[7]) {
+        for (size_t n = 0; n < c; n++) bcd_decode_time(f + n * DS3231_NUM_REGISTERS, o[n]);
+    });
+    benchmark("SWAR batch", files, count, [](const uint8_t *f, size_t c, uint8_t (*o)[7]) {
+        bcd_decode_time_batch(f, DS3231_NUM_REGISTERS, c, o);
+    });
+#endif
+
     ////////////////////// DEMONSTRATING THE API ///////////////////////
+#ifdef USE_SIMULATOR
+    RTC rtc(std::unique_ptr<EE513::BusDevice>(new DS3231Simulator()));
+#else
     RTC rtc(1, 0x68);
+#endif
 
 #ifdef TEST_TIME_API
     // Test the functionality of setting the time, setting the system time and getting the time
@@ -217,9 +328,16 @@ int main()
 #ifdef TEST_ALARM_EVERY_SECOND
     // Hit Ctrl + C to pause the alarm ringin for 5 seconds by disabling the interrupt
     // Hit Ctrl + Z to exit the program
+    // The alarm is served on the falling edge of INT/SQW, the loop sleeps in the kernel in between
     rtc.disableInterruptAlarm2();
     rtc.setTimeAlarm1(0, 0, FORMAT_0_23, AM, 0, DAY_OF_WEEK, 1);
     rtc.setRateAlarm1(ALARM_1_ONCE_PER_SECOND);
+    AlarmService secondAlarms(rtc, "gpiochip4", 17);    // INT/SQW wired to GPIO17 of a Pi 5
+    secondAlarms.onAlarm1([](int64_t edgeNs) {
+        cout << "Alarm 1 at " << edgeNs << "ns, snoozed" << endl;
+    });
+    if (secondAlarms.start()) return 1;
+    int timeoutMs = 0;  // serves a flag that is already pending, then waits for edges
     while (true)
     {
         if (!running)
@@ -231,9 +349,7 @@ int main()
             running = true;
             cout << "Alarm 1 will resume ringing" << endl;
         }
-        rtc.snoozeAlarm1();
-        cout << "Snoozed Alarm" << endl;
-        sleep(1);
+        timeoutMs = secondAlarms.dispatch(timeoutMs) ? ALARM_RETRY_MS : -1;
     }
 #endif
 
@@ -242,12 +358,11 @@ int main()
     rtc.disableInterruptAlarm1();
     rtc.setTimeAlarm2(0, FORMAT_0_23, AM, 0, DAY_OF_WEEK, 1);
     rtc.setRateAlarm2(ALARM_2_ONCE_PER_MINUTE);
-    while (running)
-    {
-        rtc.snoozeAlarm2();
-        cout << "Snoozed Alarm" << endl;
-        sleep(60);
-    }
+    AlarmService minuteAlarms(rtc, "gpiochip4", 17);    // INT/SQW wired to GPIO17 of a Pi 5
+    minuteAlarms.onAlarm2([](int64_t edgeNs) {
+        cout << "Alarm 2 at " << edgeNs << "ns, snoozed" << endl;
+    });
+    minuteAlarms.run(running);
 #endif
 
 #ifdef TEST_SQW
@@ -257,26 +372,182 @@ int main()
 #ifdef TEST_TEMPERATURE
     // prints temperature every 60 seconds
     float temp;
+    int16_t quarters;
     while (running)
     {
         temp = rtc.getTemperature();
         cout << "Temperature is: " << temp << endl;
+        if (!rtc.getTemperatureQuarters(quarters))
+            cout << "Temperature in quarter degrees: " << quarters << endl;
+        // the callback runs on another thread once the conversion is done, this one carries on
+        rtc.requestTemperatureConversion([](const temperature_conversion_t& fresh) {
+            if (!fresh.status) cout << "Fresh conversion: " << fresh.quarters / 4.0f << endl;
+        });
         sleep(60);
     }
 #endif
 
+#ifdef TEST_TEMPERATURE_SAMPLER
+    // reads each 64s conversion once and prints changes of half a degree or more
+    TemperatureSampler sampler(rtc);
+    sampler.setChangeCallback(2, [](int16_t changed) { cout << "Temperature changed to: " << changed / 4.0f << endl; });
+    if (!sampler.learnPhase())
+        cout << "Learned the conversion phase in " << sampler.busReads() << " reads" << endl;
+    int16_t sampled;
+    while (running)
+    {
+        sampler.get(sampled);
+        sampler.sleepUntilNextChange();
+    }
+    cout << "Bus reads: " << sampler.busReads() << endl;
+#endif
+
+#ifdef TEST_ALARM_SCHEDULER
+    // three deadlines on the two hardware alarms, the process sleeps until each of them
+    AlarmService schedulerAlarms(rtc, "gpiochip4", 17);    // INT/SQW wired to GPIO17 of a Pi 5
+    AlarmScheduler scheduler(rtc);
+    scheduler.attach(schedulerAlarms);
+    scheduler.scheduleIn(10, [](time_t due) { cout << "Every 10 seconds: " << due << endl; }, 10);
+    scheduler.scheduleIn(25, [](time_t due) { cout << "Once after 25 seconds: " << due << endl; });
+    scheduled_id_t never = scheduler.scheduleIn(15, [](time_t) { cout << "Cancelled, never printed" << endl; });
+    scheduler.cancel(never);
+    schedulerAlarms.run(running);
+#endif
+
+#ifdef TEST_CRON
+    // 09:00:00 on weekdays, compiled by the compiler into a daily hardware match plus a weekday filter
+    constexpr cron_alarm_t workdays = cron_compile("0 0 9 * * 1-5");
+    static_assert(workdays.valid && workdays.rate == ALARM_1_ONCE_PER_DAY && !workdays.rearm, "unexpected plan");
+    // a step restricts the days, midnight of every second day of the month: the 1st, 3rd, 5th, ...
+    constexpr cron_alarm_t everyOtherDay = cron_compile("0 0 0 */2 * *");
+    static_assert(everyOtherDay.valid && !everyOtherDay.anyDay && everyOtherDay.anyWeekday &&
+                  !cron_matches(everyOtherDay, 1704153600) && cron_matches(everyOtherDay, 1704240000), "*/2 must skip the 2nd");
+    time_t cronNow;
+    rtc.getEpoch(cronNow);
+    cout << "Hardware matches per fire: " << workdays.wakeupsPerFire << ", next fire times:";
+    for (int64_t fire = cronNow, n = 0; n < 3; n++)
+    {
+        fire = nextFireTime(workdays, fire);
+        cout << " " << fire;
+    }
+    cout << endl;
+    AlarmService cronAlarms(rtc, "gpiochip4", 17);       // INT/SQW wired to GPIO17 of a Pi 5
+    CronAlarm cron(rtc, workdays, [](time_t fired) { cout << "Cron fired at " << fired << endl; });
+    cron.attach(cronAlarms);
+    if (!cron.arm()) cronAlarms.run(running);
+    cout << "Wakeups: " << cron.wakeupCount() << ", fires: " << cron.fireCount() << endl;
+#endif
+
+#ifdef TEST_TIMER_WHEEL
+    // 5000 timeouts of up to 2 minutes, half of them cancelled, ticked by the 1Hz square wave
+    rtc.enableSquareWave(SQW_1HZ);
+    TimerWheel wheel(5000);
+    int expired = 0;
+    vector<wheel_timer_t> timeouts;
+    for (int i = 0; i < 5000; i++)
+        timeouts.push_back(wheel.add(1 + rand() % 120, [&expired]() { expired++; }));
+    for (size_t i = 0; i < timeouts.size(); i += 2)
+        wheel.cancel(timeouts[i]);
+    function<void()> report = [&]() {
+        cout << "Tick " << wheel.ticks() << ": " << expired << " expired, " << wheel.pending() << " pending" << endl;
+        wheel.add(10, report);
+    };
+    wheel.add(10, report);
+    wheel.runOnSquareWave("gpiochip4", 17, running);     // INT/SQW wired to GPIO17 of a Pi 5
+#endif
+
+#ifdef TEST_APPLY_CONFIG
+    // brings the module to a known state in one read and as few write bursts as possible
+    rtc_config_t config = {};
+    config.set_time = true;
+    config.time = time(NULL);
+    config.clock_12hr = FORMAT_0_23;
+    config.set_alarm_1 = true;
+    config.alarm_1 = {1, 0, 30, 7, FORMAT_0_23, AM, DAY_OF_WEEK, {2}, {}};
+    config.alarm_1.rate_alarm.rate_1 = ALARM_1_ONCE_PER_DAY;
+    config.set_alarm_2 = true;
+    config.alarm_2 = {2, 0, 0, 0, FORMAT_0_23, AM, DAY_OF_WEEK, {1}, {}};
+    config.alarm_2.rate_alarm.rate_2 = ALARM_2_ONCE_PER_MINUTE;
+    config.oscillator_enabled = true;
+    config.interrupt_control = true;
+    config.alarm_1_int_enabled = true;
+    config.clear_oscillator_stopped = true;
+    config.clear_alarm_flags = true;
+    int bursts;
+    if (!rtc.apply(config, bursts))
+        cout << "Configuration applied in " << bursts << " write bursts" << endl;
+    // applying it again writes nothing but the time
+    if (!rtc.apply(config, bursts))
+        cout << "Configuration applied again in " << bursts << " write bursts" << endl;
+    config.set_time = false;
+    config.alarm_1.minutes = 45;
+    if (!rtc.apply(config, bursts))
+        cout << "Alarm 1 moved in " << bursts << " write bursts" << endl;
+    rtc.displayAlarm1();
+#endif
+
+#ifdef TEST_REGISTER_MAP
+    // the control register of a 1Hz square wave kept on battery, folded into a constant by the compiler
+    constexpr uint8_t sqwControl = burst_control::encode(false, true, SQW_1HZ, false, false, false)[0];
+    static_assert(sqwControl == MASK_BAT_BACKUP_SQW_ENABLE, "unexpected control register");
+    rtc_snapshot_t regmap;
+    if (!rtc.snapshot(regmap))
+    {
+        // several fields of one burst read, decoded at once
+        typedef rtc_burst<field_time_seconds, field_time_minutes, field_time_month, field_time_year> burst_clock;
+        auto [seconds, minutes, month, year] = burst_clock::decode(regmap.registers);
+        cout << "Minutes: " << (int)minutes << ", seconds: " << (int)seconds << ", month: " << (int)month
+             << ", year: " << 2000 + year + (field_time_century::get(regmap.registers) ? 100 : 0) << endl;
+        cout << "Square wave rate: " << field_control_sqw_rate::get(regmap.registers)
+             << ", Alarm 1 mask bits: " << (int)field_alarm_1_mask_bits::get(regmap.registers) << endl;
+        if ((regmap.registers[REG_CONTROL] & burst_control::mask(0)) == sqwControl) cout << "The square wave is set up" << endl;
+    }
+#endif
+
 #ifdef TEST_WITH_MQTT
-    // publishes a string with temperature every 60 seconds to the MQTT broker configured
+    // samples the temperature every 60 seconds on its own thread and publishes the samples to the
+    // MQTT broker configured from this one, so a slow broker cannot delay the sampling
+    SpscRing<rtc_sample_t, 64> samples;
+    thread sampling([&rtc, &samples]() {
+        uint64_t sequence = 0;
+        int64_t next = monotonic_ns();
+        while (running)
+        {
+            rtc_sample_t sample;
+            struct timespec ts;
+            sample.sequence = sequence++;
+            sample.monotonic_ns = monotonic_ns();
+            clock_gettime(CLOCK_REALTIME, &ts);
+            sample.realtime_ns = ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+            // a fresh conversion instead of the one from the last 64s cycle
+            temperature_conversion_t fresh = rtc.requestTemperatureConversion().get();
+            if (!fresh.status && !rtc.getEpoch(sample.rtc_epoch))
+            {
+                sample.temperature_quarters = fresh.quarters;
+                samples.push(sample);
+            }
+            next += 60 * NS_PER_SECOND;
+            if (sleep_until_ns(CLOCK_MONOTONIC, next, &running)) break;
+        }
+    });
     float temp;
     char *topic = TOPIC;
+    rtc_sample_t sample;
     while (running && (rc==0))
     {
-        temp = rtc.getTemperature();
+        if (!samples.pop(sample))
+        {
+            this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+        temp = sample.temperature_quarters / 4.0f;
         cout << "Temperature is: " << temp << endl;
         sprintf(buf, "Temperature is: %.2f", temp);
         sendMQTTMessage(message, buf, topic);
-        sleep(60);
     }
+    running = false;
+    sampling.join();
+    cout << "Samples dropped: " << samples.overrunCount() << endl;
 #endif
 
 #ifdef TEST_32kHz
@@ -289,6 +560,44 @@ int main()
         cout << "Set to ON" << endl;
         sleep(5);
     }
+#endif
+#ifdef TEST_SECONDS_EDGE
+    // finds the seconds rollover by polling the seconds register, then on the 1Hz square wave
+    SecondsEdgeDetector detector(rtc, "gpiochip4", 17);   // INT/SQW wired to GPIO17 of a Pi 5
+    rtc_edge_t edge;
+    if (!detector.findEdge(edge, EDGE_POLL_SECONDS))
+        cout << "Polled edge: phase " << edge.phase_ns << "ns +/- " << edge.error_ns << "ns" << endl;
+    rtc.enableSquareWave(SQW_1HZ);
+    if (!detector.findEdge(edge, EDGE_SQW_GPIO))
+        cout << "SQW edge: phase " << edge.phase_ns << "ns +/- " << edge.error_ns << "ns" << endl;
+#endif
+#ifdef TEST_ALIGNED_SET
+    // sets the RTC at a system second boundary and verifies it, then feeds the measured residual back into the lead
+    SecondsEdgeDetector offsetDetector(rtc);
+    int64_t leadNs = 0, offsetNs, offsetErrorNs;
+    for (int round = 0; round < 3; round++)
+    {
+        if (offsetDetector.setTimeAligned(offsetNs, offsetErrorNs, FORMAT_0_23, leadNs)) break;
+        cout << "Lead " << leadNs << "ns: RTC - system = " << offsetNs << "ns +/- " << offsetErrorNs << "ns" << endl;
+        leadNs -= offsetNs;
+    }
+#endif
+#ifdef TEST_DISCIPLINE
+    // keeps the system clock on the RTC while NTP is unavailable, learning the RTC drift while it is
+    SecondsEdgeDetector disciplineDetector(rtc);
+    ClockDiscipline discipline(disciplineDetector, EDGE_POLL_SECONDS, 16, geteuid() != 0);
+    TemperatureDriftModel temperatureModel;     // learns the drift against temperature while NTP is up
+    discipline.setTemperatureModel(rtc, temperatureModel);
+    discipline.run(running);
+#endif
+#ifdef TEST_AGING_CALIBRATION
+    // trims the aging offset against the NTP synchronised system clock, a step every 6 hours at most
+    int8_t aging;
+    if (!rtc.getAgingOffset(aging))
+        cout << "Aging offset: " << (int)aging << endl;
+    SecondsEdgeDetector agingDetector(rtc);
+    AgingCalibrator calibrator(rtc, agingDetector, "aging_history.csv");
+    calibrator.run(running);
 #endif
     ////////////////////// DEMONSTRATING THE API ///////////////////////
 